@@ -42,3 +42,18 @@ buffer_pool_free(buffer_pool_t* pool, u_char* buffer)
 	pool->free_head = (list_node_t*)buffer;
 	pthread_mutex_unlock(&pool->lock);
 }
+
+void
+buffer_pool_destroy(buffer_pool_t* pool)
+{
+	list_node_t* cur;
+
+	while (pool->free_head != NULL)
+	{
+		cur = pool->free_head;
+		pool->free_head = cur->next;
+		free(cur);
+	}
+
+	pthread_mutex_destroy(&pool->lock);
+}
@@ -2,7 +2,8 @@
 #define __BUFFER_POOL_H__
 
 // includes
-#include "../common.h"
+#include <pthread.h>
+#include "common.h"
 
 // typedefs
 typedef struct list_node_s {
@@ -22,4 +23,6 @@ u_char* buffer_pool_alloc(buffer_pool_t* pool);
 
 void buffer_pool_free(buffer_pool_t* pool, u_char* buffer);
 
+void buffer_pool_destroy(buffer_pool_t* pool);		// frees the buffers that were returned to the pool
+
 #endif // __BUFFER_POOL_H__
@@ -1,7 +1,12 @@
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include "common.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
 // globals
 char* program_name;
 
@@ -32,3 +37,29 @@ error(int errnum, const char *message, ...)
 	verror(errnum, message, args);
 	va_end(args);
 }
+
+uint64_t
+get_cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+
+	// no cycle counter, use nanoseconds
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+void
+eval_stats_update(eval_stats_t* stats, bool_t result, uint64_t start_cycles)
+{
+	// Note: the stats may be shared by several threads
+	__sync_fetch_and_add(&stats->evals, 1);
+	if (result)
+	{
+		__sync_fetch_and_add(&stats->matches, 1);
+	}
+	__sync_fetch_and_add(&stats->cycles, get_cycles() - start_cycles);
+}
@@ -18,6 +18,7 @@
 // macros
 #define array_entries(x) (sizeof(x) / sizeof(x[0]))
 #define min(x, y) (((x) < (y)) ? (x) : (y))
+#define max(x, y) (((x) > (y)) ? (x) : (y))
 
 #define mem_copy(dst, src, n)	(((char *) memcpy(dst, src, n)) + (n))
 #define mem_copy_str(dst, src)	mem_copy(dst, (src).data, (src).len)
@@ -34,6 +35,12 @@ typedef struct {
 	char* data;
 } str_t;
 
+typedef struct {
+	volatile uint64_t evals;
+	volatile uint64_t matches;
+	volatile uint64_t cycles;
+} eval_stats_t;
+
 // globals
 extern char* program_name;
 
@@ -41,4 +48,7 @@ extern char* program_name;
 void verror(int errnum, const char *message, va_list args);
 void error(int errnum, const char *message, ...);
 
+uint64_t get_cycles();
+void eval_stats_update(eval_stats_t* stats, bool_t result, uint64_t start_cycles);
+
 #endif // __COMMON_H__
@@ -1,16 +1,47 @@
+#include <pthread.h>
 #include <stddef.h>
+#include <errno.h>
 #include <string.h>
 #include <stdlib.h>
 #include "compressed_file.h"
+#include "buffer_pool.h"
 #include "common.h"
+#include "itp.h"
 
+#ifdef COMPRESSED_FILE_LIBDEFLATE
+#include <libdeflate.h>
+#endif // COMPRESSED_FILE_LIBDEFLATE
 
+// constants
+#define PIPELINE_BUFFER_SIZE (1048576)
+#define WHOLE_MEMBER_MIN_INPUT (262144)			// smaller inputs are inflated with zlib
+#define WHOLE_MEMBER_MIN_OUTPUT (4194304)
+#define WHOLE_MEMBER_MAX_OUTPUT (33554432)		// larger members disable whole member inflate for the file
+
+// enums
 enum {
 	STATE_INFLATE,
 	STATE_END,
 	STATE_RESYNC,
 };
 
+enum {
+	PIPELINE_FLAG_END =		0x01,		// the last buffer of the read
+	PIPELINE_FLAG_ERROR =	0x02,		// the read failed
+};
+
+// typedefs
+typedef struct {
+	compressed_file_state_t* state;
+	long start;
+	long end;
+	itp_t itp;
+	buffer_pool_t pool;
+	u_char* buffer;						// the buffer that is being filled by the fetch thread
+	size_t size;
+	volatile bool_t stopped;			// set by the process thread, the fetch thread stops reading
+} compressed_file_pipeline_t;
+
 
 static long
 compressed_file_get_pos(compressed_file_state_t* state)
@@ -18,6 +49,132 @@ compressed_file_get_pos(compressed_file_state_t* state)
 	return state->cur_pos - state->strm.avail_in;
 }
 
+static void
+compressed_file_member_start(compressed_file_state_t* state, long pos)
+{
+	if (state->range_end <= 0 || pos < state->range_end)
+	{
+		return;
+	}
+
+	// the member does not belong to the range, the observer decides when to stop
+	state->range_end = 0;
+	if (state->observer.range_end)
+	{
+		state->observer.range_end(state->context);
+	}
+}
+
+#ifdef COMPRESSED_FILE_LIBDEFLATE
+/*
+	Whole member inflate - when a gzip member starts, and the input buffer holds the complete member,
+	the member is inflated with libdeflate in a single call, which is considerably faster than zlib.
+	The output is passed to the observer in chunks of OUTPUT_CHUNK_SIZE, as in streaming mode.
+	A failed attempt is wasted work, since the member is then inflated with zlib from the same
+	position (e.g. members that cross the end of the input buffer, corrupt members), so the attempts
+	are guided by the size of the previous member (libdeflate / zlib) -
+	- the attempt is skipped when the rest of the input buffer is smaller than the previous member
+	- the output buffer is sized according to the previous member, it is never grown on failure,
+		since a member that crosses the end of the input fails the same way
+	- once a member inflates to more than WHOLE_MEMBER_MAX_OUTPUT, whole member inflate is disabled
+		for the file (e.g. regular gzip files, files written with a large -m)
+	zlib is also used after a resync, and for small input buffers (e.g. curl without a pipeline),
+	where most members would not fit.
+*/
+static void
+compressed_file_set_member_size(compressed_file_state_t* state, size_t in_size, size_t out_size)
+{
+	state->member_in_size = in_size;
+	state->member_out_size = out_size;
+
+	if (out_size > WHOLE_MEMBER_MAX_OUTPUT)
+	{
+		state->whole_member_disabled = TRUE;
+	}
+}
+
+static bool_t
+compressed_file_inflate_member(compressed_file_state_t* state)
+{
+	enum libdeflate_result rc;
+	size_t out_size;
+	size_t in_size;
+	size_t size;
+	size_t pos;
+
+	// Note: returns FALSE when the member should be inflated with zlib
+	if (state->whole_member_disabled ||
+		state->strm.avail_in < max(WHOLE_MEMBER_MIN_INPUT, state->member_in_size))
+	{
+		return FALSE;
+	}
+
+	if (state->decompressor == NULL)
+	{
+		state->decompressor = libdeflate_alloc_decompressor();
+		if (state->decompressor == NULL)
+		{
+			return FALSE;
+		}
+	}
+
+	// leave some room for a larger member
+	size = state->member_out_size + state->member_out_size / 4;
+	size = min(max(size, WHOLE_MEMBER_MIN_OUTPUT), WHOLE_MEMBER_MAX_OUTPUT);
+	if (size > state->member_buf_size)
+	{
+		free(state->member_buf);
+		state->member_buf_size = 0;
+
+		state->member_buf = malloc(size);
+		if (state->member_buf == NULL)
+		{
+			return FALSE;
+		}
+		state->member_buf_size = size;
+	}
+
+	rc = libdeflate_gzip_decompress_ex(state->decompressor, state->strm.next_in, state->strm.avail_in,
+		state->member_buf, state->member_buf_size, &in_size, &out_size);
+	if (rc != LIBDEFLATE_SUCCESS)
+	{
+		if (rc == LIBDEFLATE_INSUFFICIENT_SPACE && state->member_buf_size >= WHOLE_MEMBER_MAX_OUTPUT)
+		{
+			state->whole_member_disabled = TRUE;
+		}
+		return FALSE;
+	}
+
+	compressed_file_set_member_size(state, in_size, out_size);
+
+	state->strm.next_in += in_size;
+	state->strm.avail_in -= in_size;
+
+	state->state = STATE_INFLATE;
+
+	for (pos = 0; pos < out_size; pos += size)
+	{
+		size = min(OUTPUT_CHUNK_SIZE, out_size - pos);
+		state->observer.process_chunk(state->context, state->member_buf + pos, size);
+		if (state->stopped)
+		{
+			return TRUE;
+		}
+	}
+
+	if (state->observer.segment_end)
+	{
+		state->observer.segment_end(state->context, compressed_file_get_pos(state), FALSE);
+	}
+
+	compressed_file_member_start(state, compressed_file_get_pos(state));
+
+	state->state = STATE_END;
+
+	return TRUE;
+}
+#endif // COMPRESSED_FILE_LIBDEFLATE
+
 static bool_t
 compressed_file_inflate(compressed_file_state_t* state)
 {
@@ -25,6 +182,18 @@ compressed_file_inflate(compressed_file_state_t* state)
 
 	while (state->strm.avail_in > 0)
 	{
+#ifdef COMPRESSED_FILE_LIBDEFLATE
+		// Note: total_in is zero only at the start of a member (after init / inflateReset)
+		if (state->strm.total_in == 0 && compressed_file_inflate_member(state))
+		{
+			if (state->stopped)
+			{
+				return TRUE;
+			}
+			continue;
+		}
+#endif // COMPRESSED_FILE_LIBDEFLATE
+
 		state->state = STATE_INFLATE;
 
 		// inflate data until more input is needed / end of stream
@@ -41,6 +210,10 @@ compressed_file_inflate(compressed_file_state_t* state)
 			}
 
 			state->observer.process_chunk(state->context, state->out, sizeof(state->out) - state->strm.avail_out);
+			if (state->stopped)
+			{
+				return TRUE;
+			}
 
 			switch (rc)
 			{
@@ -61,11 +234,17 @@ compressed_file_inflate(compressed_file_state_t* state)
 
 		if (rc == Z_STREAM_END)
 		{
+#ifdef COMPRESSED_FILE_LIBDEFLATE
+			compressed_file_set_member_size(state, state->strm.total_in, state->strm.total_out);
+#endif // COMPRESSED_FILE_LIBDEFLATE
+
 			if (state->observer.segment_end)
 			{
 				state->observer.segment_end(state->context, compressed_file_get_pos(state), FALSE);
 			}
 
+			compressed_file_member_start(state, compressed_file_get_pos(state));
+
 			state->state = STATE_END;
 
 			rc = inflateReset(&state->strm);
@@ -132,18 +311,20 @@ compressed_file_resync(compressed_file_state_t* state)
 			state->observer.resync(state->context, compressed_file_get_pos(state) - sizeof(sync_word));
 		}
 
+		compressed_file_member_start(state, compressed_file_get_pos(state) - sizeof(sync_word));
+
 		break;
 	}
 
 	return TRUE;
 }
 
-static size_t
-compressed_file_handle_data(void* buf, size_t mbr_size, size_t mbr_count, void* data)
+static bool_t
+compressed_file_handle_input(void* context, u_char* buf, size_t size)
 {
-	compressed_file_state_t* state = data;
-	size_t size = mbr_size * mbr_count;
+	compressed_file_state_t* state = context;
 
+	// Note: returns FALSE on error / when stopped
 	state->cur_pos += size;
 
 	state->strm.next_in = buf;
@@ -151,142 +332,116 @@ compressed_file_handle_data(void* buf, size_t mbr_size, size_t mbr_count, void*
 
 	while (state->strm.avail_in > 0)
 	{
+		if (state->stopped)
+		{
+			return FALSE;
+		}
+
 		switch (state->state)
 		{
 		case STATE_INFLATE:
 		case STATE_END:
 			if (!compressed_file_inflate(state))
 			{
-				return 0;
+				return FALSE;
 			}
 			break;
 
 		case STATE_RESYNC:
 			if (!compressed_file_resync(state))
 			{
-				return 0;
+				return FALSE;
 			}
 			break;
 		}
 	}
 
-	return size;
+	return TRUE;
 }
 
-long
-compressed_file_init(compressed_file_state_t* state, curl_ext_conf_t* conf, const char* url, compressed_file_observer_t* observer, void* context)
+static const char*
+compressed_file_parse_range(const char* path, long* start, long* end)
 {
 	const char* range_start;
-	const char* scheme_end;
-	const char* prefix;
-	CURLcode res;
-	str_t url_str;
-	char range[64];
-	char* url_copy;
-	long prefix_len;
-	long url_len;
-	long start;
-	long end;
-	int rc;
-
-	memset(state, 0, offsetof(compressed_file_state_t, out));
 
-	scheme_end = strstr(url, "://");
-	if (scheme_end != NULL)
-	{
-		scheme_end += sizeof("://") - 1;
-		prefix = "";
-		prefix_len = 0;
-	}
-	else
-	{
-		scheme_end = url;
-		prefix = "file://localhost";
-		prefix_len = sizeof("file://localhost") - 1;
-	}
-
-
-	range_start = strchr(scheme_end, ':');
-	if (range_start != NULL)
-	{
-		if (sscanf(range_start + 1, "%ld-%ld", &start, &end) != 2)
-		{
-			start = end = 0;
-			range_start = url + strlen(url);
-		}
-	}
-	else
+	// returns the end of the file name - path:<start>-<end>
+	range_start = strchr(path, ':');
+	if (range_start == NULL || sscanf(range_start + 1, "%ld-%ld", start, end) != 2)
 	{
-		start = end = 0;
-		range_start = url + strlen(url);
+		*start = *end = 0;
+		return path + strlen(path);
 	}
 
+	return range_start;
+}
 
-	url_len = prefix_len + range_start - url;
+static compressed_file_backend_t*
+compressed_file_get_backend(const char* url, str_t* name, long* start, long* end)
+{
+	static const char file_scheme[] = "file://";
+	static const char localhost[] = "localhost";
+	compressed_file_backend_t* backend;
+	const char* range_start;
+	const char* path;
 
-	state->curl = curl_easy_init();
-	if (!state->curl)
+	if (strcmp(url, "-") == 0)
 	{
-		error(0, "curl_easy_init failed");
-		goto failed;
+		name->data = (char*)url;
+		name->len = 1;
+		*start = *end = 0;
+		return &compressed_file_stdin;
 	}
 
-	url_str.data = (char*)url;
-	url_str.len = range_start - url;
-
-	if (!curl_ext_ctx_init(&state->curl_ext, conf, &url_str, state->curl))
+	// urls without a scheme and file:// urls are read directly, other urls with curl
+	if (strncmp(url, file_scheme, sizeof(file_scheme) - 1) == 0)
 	{
-		goto failed;
-	}
+		path = url + sizeof(file_scheme) - 1;
+		if (strncmp(path, localhost, sizeof(localhost) - 1) == 0)
+		{
+			path += sizeof(localhost) - 1;
+		}
 
-	if (state->curl_ext.ctx == NULL)
+		url = path;
+		backend = &compressed_file_local;
+	}
+	else
 	{
-		// no curl extension - set the url as is
-		url_copy = malloc(url_len + 1);
-		if (url_copy == NULL)
+		path = strstr(url, "://");
+		if (path != NULL)
 		{
-			error(0, "malloc failed");
-			goto failed;
+			path += sizeof("://") - 1;
+			backend = &compressed_file_curl;
 		}
-
-		memcpy(url_copy, prefix, prefix_len);
-		memcpy(url_copy + prefix_len, url, range_start - url);
-		url_copy[url_len] = '\0';
-
-		state->url = url_copy;
-
-		res = curl_easy_setopt(state->curl, CURLOPT_URL, url_copy);
-		if (res != CURLE_OK)
+		else
 		{
-			error(0, "curl_easy_setopt(CURLOPT_URL) failed %d", res);
-			goto failed;
+			path = url;
+			backend = &compressed_file_local;
 		}
 	}
 
-	res = curl_easy_setopt(state->curl, CURLOPT_WRITEFUNCTION, compressed_file_handle_data);
-	if (res != CURLE_OK)
-	{
-		error(0, "curl_easy_setopt(CURLOPT_WRITEFUNCTION) failed %d", res);
-		goto failed;
-	}
+	range_start = compressed_file_parse_range(path, start, end);
 
-	res = curl_easy_setopt(state->curl, CURLOPT_WRITEDATA, state);
-	if (res != CURLE_OK)
-	{
-		error(0, "curl_easy_setopt(CURLOPT_WRITEDATA) failed %d", res);
-		goto failed;
-	}
+	name->data = (char*)url;
+	name->len = range_start - url;
+	return backend;
+}
 
-	if (end)
-	{
-		sprintf(range, "%ld-%ld", start, end - 1);
+long
+compressed_file_init(compressed_file_state_t* state, curl_ext_conf_t* conf, const char* url, compressed_file_observer_t* observer, void* context)
+{
+	str_t name;
+	long start;
+	long end;
+	int rc;
 
-		res = curl_easy_setopt(state->curl, CURLOPT_RANGE, range);
-		if (res != CURLE_OK)
-		{
-			error(0, "curl_easy_setopt(CURLOPT_RANGE) failed %d", res);
-			goto failed;
-		}
+	memset(state, 0, offsetof(compressed_file_state_t, out));
+
+	state->backend = compressed_file_get_backend(url, &name, &start, &end);
+
+	state->backend_ctx = state->backend->open(conf, &name);
+	if (state->backend_ctx == NULL)
+	{
+		goto failed;
 	}
 
 	state->input_url = strdup(url);
@@ -306,6 +461,7 @@ compressed_file_init(compressed_file_state_t* state, curl_ext_conf_t* conf, cons
 	state->observer = *observer;
 	state->context = context;
 	state->cur_pos = start;
+	state->end = end;
 
 	return compressed_file_get_pos(state);
 
@@ -316,72 +472,303 @@ failed:
 	return -1;
 }
 
+long
+compressed_file_set_soft_range(compressed_file_state_t* state, long start, long end)
+{
+	// Note: the range is open ended, the read is stopped by compressed_file_stop
+	state->cur_pos = start;
+	state->end = 0;
+	state->range_end = end;
+
+	if (start > 0)
+	{
+		// skip to the first gzip member of the range
+		state->state = STATE_RESYNC;
+		state->last_word = 0;
+	}
+
+	return compressed_file_get_pos(state);
+}
+
+void
+compressed_file_stop(compressed_file_state_t* state)
+{
+	state->stopped = TRUE;
+}
+
+long
+compressed_file_get_size(curl_ext_conf_t* conf, const char* url)
+{
+	compressed_file_backend_t* backend;
+	void* ctx;
+	str_t name;
+	long result;
+	long start;
+	long end;
+
+	backend = compressed_file_get_backend(url, &name, &start, &end);
+
+	ctx = backend->open(conf, &name);
+	if (ctx == NULL)
+	{
+		return -1;
+	}
+
+	result = backend->get_size(ctx);
+
+	backend->close(ctx);
+	return result;
+}
+
 void
 compressed_file_free(compressed_file_state_t* state)
 {
 	inflateEnd(&state->strm);
 
+#ifdef COMPRESSED_FILE_LIBDEFLATE
+	if (state->decompressor != NULL)
+	{
+		libdeflate_free_decompressor(state->decompressor);
+		state->decompressor = NULL;
+	}
+
+	free(state->member_buf);
+	state->member_buf = NULL;
+#endif // COMPRESSED_FILE_LIBDEFLATE
+
 	free(state->input_url);
 	state->input_url = NULL;
 
-	free(state->url);
-	state->url = NULL;
+	if (state->backend_ctx != NULL)
+	{
+		state->backend->close(state->backend_ctx);
+		state->backend_ctx = NULL;
+	}
+}
 
-	curl_ext_ctx_free(&state->curl_ext);
+void
+compressed_file_set_pipeline(compressed_file_state_t* state, size_t buffer_count)
+{
+	state->pipeline_buffers = buffer_count;
+}
 
-	curl_easy_cleanup(state->curl);
-	state->curl = NULL;
+void
+compressed_file_set_connections(compressed_file_state_t* state, int count)
+{
+	if (state->backend->set_connections != NULL)
+	{
+		state->backend->set_connections(state->backend_ctx, count);
+	}
 }
 
-bool_t
-compressed_file_process(compressed_file_state_t* state)
+/*
+	The input is read by a fetch thread to buffers of PIPELINE_BUFFER_SIZE, that are passed to the
+	calling thread over a bounded ring (itp). The calling thread inflates and processes the buffers,
+	so waiting for the network / disk overlaps with the processing, up to the size of the ring.
+	When the processing stops early, the fetch thread is signalled to stop, and the ring is drained
+	until its last buffer.
+*/
+static bool_t
+compressed_file_pipeline_write(compressed_file_pipeline_t* pipeline, uint32_t flags)
 {
-	CURLcode res;
-	long code;
-	long pos;
-	int i;
+	itp_buffer_t buffer;
+
+	buffer.ptr = pipeline->buffer;
+	buffer.size = pipeline->size;
+	buffer.flags = flags;
+	buffer.data = NULL;
 
-	for (i = 0; ; i++)
+	pipeline->buffer = NULL;
+	pipeline->size = 0;
+
+	while (!itp_write(&pipeline->itp, &buffer, TRUE))
 	{
-		res = curl_easy_perform(state->curl);
-		if (res == CURLE_OK)
+		if (errno == EINTR)
 		{
-			break;
+			continue;
 		}
 
-		switch (res)
+		error(errno, "itp_write failed");
+		if (buffer.ptr != NULL)
 		{
-		case CURLE_WRITE_ERROR:
-			break;
+			buffer_pool_free(&pipeline->pool, buffer.ptr);
+		}
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static bool_t
+compressed_file_pipeline_handle_input(void* context, u_char* buf, size_t size)
+{
+	compressed_file_pipeline_t* pipeline = context;
+	size_t cur_size;
+
+	while (size > 0)
+	{
+		if (pipeline->stopped)
+		{
+			return FALSE;
+		}
 
-		case CURLE_SSL_CACERT_BADFILE:
-			if (i < 5)
+		if (pipeline->buffer == NULL)
+		{
+			pipeline->buffer = buffer_pool_alloc(&pipeline->pool);
+			if (pipeline->buffer == NULL)
 			{
-				continue;
+				error(0, "buffer_pool_alloc failed");
+				return FALSE;
 			}
+		}
 
-			/* fall through */
+		cur_size = min(size, PIPELINE_BUFFER_SIZE - pipeline->size);
+		memcpy(pipeline->buffer + pipeline->size, buf, cur_size);
+		pipeline->size += cur_size;
+		buf += cur_size;
+		size -= cur_size;
 
-		default:
-			error(0, "%s: curl error %d - %s", state->input_url, res, curl_easy_strerror(res));
+		if (pipeline->size >= PIPELINE_BUFFER_SIZE &&
+			!compressed_file_pipeline_write(pipeline, 0))
+		{
+			return FALSE;
 		}
+	}
+
+	return TRUE;
+}
+
+static void*
+compressed_file_pipeline_fetch_thread(void* data)
+{
+	compressed_file_pipeline_t* pipeline = data;
+	compressed_file_state_t* state = pipeline->state;
+	uint32_t flags = PIPELINE_FLAG_END;
+
+	if (!state->backend->read(state->backend_ctx, pipeline->start, pipeline->end, compressed_file_pipeline_handle_input, pipeline))
+	{
+		flags |= PIPELINE_FLAG_ERROR;
+	}
+
+	// Note: the last buffer holds the remainder of the data (if any)
+	if (!compressed_file_pipeline_write(pipeline, flags))
+	{
+		// unexpected - the process thread would wait forever
+		exit(1);
+	}
+
+	return NULL;
+}
+
+static bool_t
+compressed_file_pipeline_process(compressed_file_state_t* state)
+{
+	compressed_file_pipeline_t pipeline;
+	itp_buffer_t buffer;
+	pthread_t thread;
+	bool_t result = TRUE;
+	int rc;
 
+	pipeline.state = state;
+	pipeline.start = state->cur_pos;
+	pipeline.end = state->end;
+	pipeline.buffer = NULL;
+	pipeline.size = 0;
+	pipeline.stopped = FALSE;
+
+	if (!itp_init(&pipeline.itp, state->pipeline_buffers))
+	{
+		error(0, "itp_init failed");
 		return FALSE;
 	}
 
-	res = curl_easy_getinfo(state->curl, CURLINFO_RESPONSE_CODE, &code);
-	if (res != CURLE_OK)
+	if (!buffer_pool_init(&pipeline.pool, PIPELINE_BUFFER_SIZE))
 	{
-		error(0, "curl_easy_getinfo(CURLINFO_RESPONSE_CODE) failed %d", res);
+		error(0, "buffer_pool_init failed");
+		itp_free(&pipeline.itp);
 		return FALSE;
 	}
 
-	if (code != 0 && (code < 200 || code >= 300))
+	rc = pthread_create(&thread, NULL, compressed_file_pipeline_fetch_thread, &pipeline);
+	if (rc != 0)
+	{
+		error(rc, "pthread_create failed");
+		result = FALSE;
+		goto done;
+	}
+
+	for (;;)
+	{
+		if (!itp_read(&pipeline.itp, &buffer, TRUE))
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			// unexpected - the fetch thread may be blocked on the ring
+			error(errno, "itp_read failed");
+			exit(1);
+		}
+
+		if (buffer.size > 0 && !pipeline.stopped &&
+			!compressed_file_handle_input(state, buffer.ptr, buffer.size))
+		{
+			// stopped / error, drain the ring until the fetch thread is done
+			pipeline.stopped = TRUE;
+			result = state->stopped;
+		}
+
+		if (buffer.ptr != NULL)
+		{
+			buffer_pool_free(&pipeline.pool, buffer.ptr);
+		}
+
+		if (buffer.flags & PIPELINE_FLAG_END)
+		{
+			if ((buffer.flags & PIPELINE_FLAG_ERROR) && !pipeline.stopped)
+			{
+				result = FALSE;
+			}
+			break;
+		}
+	}
+
+	pthread_join(thread, NULL);
+
+done:
+
+	buffer_pool_destroy(&pipeline.pool);
+	itp_free(&pipeline.itp);
+
+	return result;
+}
+
+bool_t
+compressed_file_process(compressed_file_state_t* state)
+{
+	bool_t result;
+	long pos;
+
+	if (state->pipeline_buffers > 0)
+	{
+		result = compressed_file_pipeline_process(state);
+	}
+	else
+	{
+		result = state->backend->read(state->backend_ctx, state->cur_pos, state->end, compressed_file_handle_input, state);
+	}
+
+	if (!result && !state->stopped)
 	{
-		error(0, "invalid status code %ld", code);
 		return FALSE;
 	}
 
+	if (state->stopped)
+	{
+		return TRUE;
+	}
+
 	pos = compressed_file_get_pos(state);
 	if (state->state == STATE_INFLATE && pos > 0)
 	{
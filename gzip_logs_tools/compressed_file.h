@@ -4,7 +4,7 @@
 // includes
 #include <curl/curl.h>
 #include <zlib.h>
-#include "curl_ext.h"
+#include "compressed_file_backend.h"
 
 // constants
 #define OUTPUT_CHUNK_SIZE (1048576)
@@ -17,22 +17,36 @@ typedef struct {
 	void (*resync)(void* context, long pos);
 
 	void (*segment_end)(void* context, long pos, bool_t error);
+
+	void (*range_end)(void* context);		// soft range only, see compressed_file_set_soft_range
 } compressed_file_observer_t;
 
 typedef struct {
-	char* url;
 	char* input_url;
 	compressed_file_observer_t observer;
 	void* context;
 
 	int state;
 	long cur_pos;
+	long range_end;
+	bool_t stopped;
 	unsigned short last_word;
 
-	CURL* curl;
+	long end;					// the end of the range to read, 0 = end of file
+	size_t pipeline_buffers;	// 0 = the input is processed by the reading thread
+
+	compressed_file_backend_t* backend;
+	void* backend_ctx;
 	z_stream strm;
 
-	curl_ext_ctx_t curl_ext;
+#ifdef COMPRESSED_FILE_LIBDEFLATE
+	struct libdeflate_decompressor* decompressor;
+	u_char* member_buf;			// whole member inflate output
+	size_t member_buf_size;
+	size_t member_in_size;		// the compressed / uncompressed size of the previous member
+	size_t member_out_size;
+	bool_t whole_member_disabled;
+#endif // COMPRESSED_FILE_LIBDEFLATE
 
 	u_char out[OUTPUT_CHUNK_SIZE];
 } compressed_file_state_t;
@@ -44,4 +58,30 @@ void compressed_file_free(compressed_file_state_t* state);
 
 bool_t compressed_file_process(compressed_file_state_t* state);
 
+/*
+	Soft range - the gzip members that start in [start, end) are processed in full.
+	When a member that starts at or after end is reached, observer.range_end is called,
+	and the data that follows is processed until compressed_file_stop is called.
+	Must be called after compressed_file_init, with a url that has no range.
+*/
+long compressed_file_set_soft_range(compressed_file_state_t* state, long start, long end);
+
+void compressed_file_stop(compressed_file_state_t* state);
+
+/*
+	Pipeline - the input is read by a separate thread, up to buffer_count buffers (1MB each) ahead
+	of the processing, so that the network / disk reads overlap with the inflate and the observer.
+	Must be called after compressed_file_init. The observer is called on the calling thread.
+*/
+void compressed_file_set_pipeline(compressed_file_state_t* state, size_t buffer_count);
+
+/*
+	Remote files only - the input is fetched over count concurrent connections, each fetching a
+	different part of the range. The parts are passed to the observer in order.
+	Must be called after compressed_file_init.
+*/
+void compressed_file_set_connections(compressed_file_state_t* state, int count);
+
+long compressed_file_get_size(curl_ext_conf_t* conf, const char* url);		// -1 = unknown
+
 #endif // __COMPRESSED_FILE_H__
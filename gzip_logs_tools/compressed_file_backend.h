@@ -0,0 +1,40 @@
+#ifndef __COMPRESSED_FILE_BACKEND_H__
+#define __COMPRESSED_FILE_BACKEND_H__
+
+// includes
+#include <curl/curl.h>
+#include "curl_ext.h"
+
+// constants
+#define LOCAL_INPUT_CHUNK_SIZE (4194304)		// local files - the size of the input passed to inflate at once
+
+// typedefs
+typedef bool_t (*compressed_file_data_handler_t)(void* context, u_char* buf, size_t size);	// FALSE = stop reading
+
+/*
+	An input backend - reads byte ranges of a file and passes them to a data handler, in order.
+	The backend does not keep any read position, so that the reader core can read any range
+	(e.g. prefetch the next range, read ranges in parallel, read the ranges of an index).
+*/
+typedef struct {
+	const char* name;
+
+	void* (*open)(curl_ext_conf_t* conf, str_t* url);		// the url without the range, NULL = error
+
+	// reads [start, end), end = 0 reads to the end of the file.
+	// returns FALSE on error / when the handler returns FALSE
+	bool_t (*read)(void* ctx, long start, long end, compressed_file_data_handler_t handler, void* handler_ctx);
+
+	long (*get_size)(void* ctx);		// -1 = unknown
+
+	void (*set_connections)(void* ctx, int count);		// optional, the number of concurrent requests per read
+
+	void (*close)(void* ctx);
+} compressed_file_backend_t;
+
+// globals
+extern compressed_file_backend_t compressed_file_local;
+extern compressed_file_backend_t compressed_file_stdin;
+extern compressed_file_backend_t compressed_file_curl;
+
+#endif // __COMPRESSED_FILE_BACKEND_H__
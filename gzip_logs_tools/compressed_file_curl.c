@@ -0,0 +1,652 @@
+#include <curl/curl.h>
+#include <strings.h>
+#include <string.h>
+#include <stdlib.h>
+#include "compressed_file_backend.h"
+
+// constants
+#define CURL_PART_SIZE (8388608)				// parallel reads - the size of each range request
+#define CURL_POLL_TIMEOUT (1000)				// ms
+
+// enums
+enum {
+	CURL_PART_IDLE,
+	CURL_PART_ACTIVE,
+	CURL_PART_DONE,
+};
+
+// typedefs
+typedef struct compressed_file_curl_s compressed_file_curl_t;
+
+typedef struct {
+	compressed_file_curl_t* file;
+	CURL* curl;
+	curl_ext_ctx_t curl_ext;
+	int state;
+	long start;						// the range of the current part - [start, end)
+	long end;
+	long received;
+	bool_t failed;					// the write callback failed, the error was logged
+	u_char* buf;					// the data received before the part became the head part
+	size_t size;
+} compressed_file_curl_part_t;
+
+/*
+	Remote files (http, s3 etc.) - each read is a separate request, with a range header.
+	The curl extensions (e.g. s3 signing) are initialized once, when the file is opened.
+*/
+struct compressed_file_curl_s {
+	CURL* curl;
+	curl_ext_ctx_t curl_ext;
+	curl_ext_conf_t* conf;
+	char* url;
+	compressed_file_data_handler_t handler;
+	void* handler_ctx;
+	bool_t stopped;					// the handler returned FALSE
+
+	compressed_file_curl_part_t* parts;		// parallel reads only
+	int part_count;
+	compressed_file_curl_part_t* head;		// the part that is passed to the handler
+};
+
+static size_t
+compressed_file_curl_handle_data(void* buf, size_t mbr_size, size_t mbr_count, void* data)
+{
+	compressed_file_curl_t* file = data;
+	size_t size = mbr_size * mbr_count;
+
+	if (!file->handler(file->handler_ctx, buf, size))
+	{
+		file->stopped = TRUE;
+		return 0;
+	}
+
+	return size;
+}
+
+static size_t
+compressed_file_curl_discard_data(void* buf, size_t mbr_size, size_t mbr_count, void* data)
+{
+	return mbr_size * mbr_count;
+}
+
+static size_t
+compressed_file_curl_handle_header(char* buf, size_t mbr_size, size_t mbr_count, void* data)
+{
+	static const char content_range[] = "content-range:";
+	size_t size = mbr_size * mbr_count;
+	char* slash;
+
+	// Content-Range: bytes 0-0/<size>
+	if (size > sizeof(content_range) - 1 &&
+		strncasecmp(buf, content_range, sizeof(content_range) - 1) == 0)
+	{
+		slash = memchr(buf, '/', size);
+		if (slash != NULL)
+		{
+			*(long*)data = strtol(slash + 1, NULL, 10);
+		}
+	}
+
+	return size;
+}
+
+static bool_t
+compressed_file_curl_init_ext(compressed_file_curl_t* file, CURL* curl, curl_ext_ctx_t* curl_ext)
+{
+	CURLcode res;
+	str_t url_str;
+
+	url_str.data = file->url;
+	url_str.len = strlen(file->url);
+
+	if (!curl_ext_ctx_init(curl_ext, file->conf, &url_str, curl))
+	{
+		return FALSE;
+	}
+
+	if (curl_ext->ctx == NULL)
+	{
+		// no curl extension - set the url as is
+		res = curl_easy_setopt(curl, CURLOPT_URL, file->url);
+		if (res != CURLE_OK)
+		{
+			error(0, "curl_easy_setopt(CURLOPT_URL) failed %d", res);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static bool_t
+compressed_file_curl_init_handle(compressed_file_curl_t* file, CURL** curl, curl_ext_ctx_t* curl_ext)
+{
+	*curl = curl_easy_init();
+	if (!*curl)
+	{
+		error(0, "curl_easy_init failed");
+		return FALSE;
+	}
+
+	return compressed_file_curl_init_ext(file, *curl, curl_ext);
+}
+
+static void
+compressed_file_curl_free_parts(compressed_file_curl_t* file)
+{
+	compressed_file_curl_part_t* part;
+	int i;
+
+	if (file->parts == NULL)
+	{
+		return;
+	}
+
+	for (i = 0; i < file->part_count; i++)
+	{
+		part = &file->parts[i];
+
+		curl_ext_ctx_free(&part->curl_ext);
+		curl_easy_cleanup(part->curl);
+		free(part->buf);
+	}
+
+	free(file->parts);
+	file->parts = NULL;
+}
+
+static void
+compressed_file_curl_close(void* ctx)
+{
+	compressed_file_curl_t* file = ctx;
+
+	compressed_file_curl_free_parts(file);
+
+	curl_ext_ctx_free(&file->curl_ext);
+	curl_easy_cleanup(file->curl);
+	free(file);
+}
+
+static void*
+compressed_file_curl_open(curl_ext_conf_t* conf, str_t* url)
+{
+	compressed_file_curl_t* file;
+
+	file = calloc(1, sizeof(*file) + url->len + 1);
+	if (file == NULL)
+	{
+		error(0, "calloc failed");
+		return NULL;
+	}
+
+	file->url = (char*)(file + 1);
+	memcpy(file->url, url->data, url->len);
+	file->url[url->len] = '\0';
+
+	file->conf = conf;
+	file->part_count = 1;
+
+	if (!compressed_file_curl_init_handle(file, &file->curl, &file->curl_ext))
+	{
+		goto failed;
+	}
+
+	return file;
+
+failed:
+
+	compressed_file_curl_close(file);
+	return NULL;
+}
+
+static bool_t
+compressed_file_curl_read_single(compressed_file_curl_t* file, long start, long end, compressed_file_data_handler_t handler, void* handler_ctx)
+{
+	CURLcode res;
+	char range[64];
+	long code;
+	int i;
+
+	if (end > 0)
+	{
+		sprintf(range, "%ld-%ld", start, end - 1);
+	}
+	else
+	{
+		sprintf(range, "%ld-", start);
+	}
+
+	if (curl_easy_setopt(file->curl, CURLOPT_RANGE, start > 0 || end > 0 ? range : NULL) != CURLE_OK ||
+		curl_easy_setopt(file->curl, CURLOPT_WRITEFUNCTION, compressed_file_curl_handle_data) != CURLE_OK ||
+		curl_easy_setopt(file->curl, CURLOPT_WRITEDATA, file) != CURLE_OK)
+	{
+		error(0, "%s: curl_easy_setopt failed", file->url);
+		return FALSE;
+	}
+
+	file->handler = handler;
+	file->handler_ctx = handler_ctx;
+	file->stopped = FALSE;
+
+	for (i = 0; ; i++)
+	{
+		res = curl_easy_perform(file->curl);
+		if (res == CURLE_OK)
+		{
+			break;
+		}
+
+		switch (res)
+		{
+		case CURLE_WRITE_ERROR:
+			if (file->stopped)
+			{
+				return FALSE;
+			}
+			break;
+
+		case CURLE_SSL_CACERT_BADFILE:
+			if (i < 5)
+			{
+				continue;
+			}
+
+			/* fall through */
+
+		default:
+			break;
+		}
+
+		error(0, "%s: curl error %d - %s", file->url, res, curl_easy_strerror(res));
+		return FALSE;
+	}
+
+	res = curl_easy_getinfo(file->curl, CURLINFO_RESPONSE_CODE, &code);
+	if (res != CURLE_OK)
+	{
+		error(0, "curl_easy_getinfo(CURLINFO_RESPONSE_CODE) failed %d", res);
+		return FALSE;
+	}
+
+	if (code != 0 && (code < 200 || code >= 300))
+	{
+		error(0, "invalid status code %ld", code);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static long
+compressed_file_curl_get_size(void* ctx)
+{
+	compressed_file_curl_t* file = ctx;
+	long result = -1;
+
+	// Note: not using HEAD, since the s3 extension signs GET requests
+	if (curl_easy_setopt(file->curl, CURLOPT_RANGE, "0-0") != CURLE_OK ||
+		curl_easy_setopt(file->curl, CURLOPT_WRITEFUNCTION, compressed_file_curl_discard_data) != CURLE_OK ||
+		curl_easy_setopt(file->curl, CURLOPT_HEADERFUNCTION, compressed_file_curl_handle_header) != CURLE_OK ||
+		curl_easy_setopt(file->curl, CURLOPT_HEADERDATA, &result) != CURLE_OK)
+	{
+		return -1;
+	}
+
+	if (curl_easy_perform(file->curl) != CURLE_OK)
+	{
+		result = -1;
+	}
+
+	// Note: the header data points to the stack
+	curl_easy_setopt(file->curl, CURLOPT_HEADERFUNCTION, NULL);
+	curl_easy_setopt(file->curl, CURLOPT_HEADERDATA, NULL);
+
+	return result;
+}
+
+/// parallel read
+/*
+	The range is split to parts of CURL_PART_SIZE, and up to part_count parts are fetched
+	concurrently (curl multi), over separate connections. The parts are passed to the handler
+	in order - the head part (the lowest part that was not passed yet) is passed as it arrives,
+	the data of the following parts is buffered until they become the head part. A part is
+	assigned a new range only after it was passed to the handler, so the memory is bounded by
+	part_count * CURL_PART_SIZE.
+	Since the data is passed in order, the reader sees a contiguous gzip stream, the parts do
+	not need to start at a gzip member.
+*/
+static size_t
+compressed_file_curl_part_handle_data(void* buf, size_t mbr_size, size_t mbr_count, void* data)
+{
+	compressed_file_curl_part_t* part = data;
+	compressed_file_curl_t* file = part->file;
+	size_t size = mbr_size * mbr_count;
+	long code;
+
+	if (part->received == 0)
+	{
+		// Note: a 200 response means the server ignored the range, the data must not be passed
+		if (curl_easy_getinfo(part->curl, CURLINFO_RESPONSE_CODE, &code) != CURLE_OK || code != 206)
+		{
+			error(0, "%s: range %ld-%ld, invalid status code %ld", file->url, part->start, part->end - 1, code);
+			part->failed = TRUE;
+			return 0;
+		}
+	}
+
+	if (part->received + size > part->end - part->start)
+	{
+		error(0, "%s: range %ld-%ld, unexpected response size", file->url, part->start, part->end - 1);
+		part->failed = TRUE;
+		return 0;
+	}
+
+	part->received += size;
+
+	if (part == file->head)
+	{
+		if (!file->handler(file->handler_ctx, buf, size))
+		{
+			file->stopped = TRUE;
+			return 0;
+		}
+
+		return size;
+	}
+
+	if (part->buf == NULL)
+	{
+		part->buf = malloc(CURL_PART_SIZE);
+		if (part->buf == NULL)
+		{
+			error(0, "malloc failed");
+			return 0;
+		}
+	}
+
+	memcpy(part->buf + part->size, buf, size);
+	part->size += size;
+
+	return size;
+}
+
+static bool_t
+compressed_file_curl_part_start(CURLM* multi, compressed_file_curl_part_t* part, long start, long end)
+{
+	compressed_file_curl_t* file = part->file;
+	CURLMcode res;
+	char range[64];
+
+	// Note: the extension context is created again for each part, since the parts of a large object may be
+	//	requested long after the read started, after a signature (e.g. s3) created at that time would expire
+	curl_ext_ctx_free(&part->curl_ext);
+	if (!compressed_file_curl_init_ext(file, part->curl, &part->curl_ext))
+	{
+		return FALSE;
+	}
+
+	part->start = start;
+	part->end = end;
+	part->received = 0;
+	part->failed = FALSE;
+	part->size = 0;
+
+	sprintf(range, "%ld-%ld", start, end - 1);
+
+	if (curl_easy_setopt(part->curl, CURLOPT_RANGE, range) != CURLE_OK ||
+		curl_easy_setopt(part->curl, CURLOPT_WRITEFUNCTION, compressed_file_curl_part_handle_data) != CURLE_OK ||
+		curl_easy_setopt(part->curl, CURLOPT_WRITEDATA, part) != CURLE_OK ||
+		curl_easy_setopt(part->curl, CURLOPT_PRIVATE, part) != CURLE_OK)
+	{
+		error(0, "%s: curl_easy_setopt failed", file->url);
+		return FALSE;
+	}
+
+	res = curl_multi_add_handle(multi, part->curl);
+	if (res != CURLM_OK)
+	{
+		error(0, "%s: curl_multi_add_handle failed %d", file->url, res);
+		return FALSE;
+	}
+
+	part->state = CURL_PART_ACTIVE;
+	return TRUE;
+}
+
+static bool_t
+compressed_file_curl_part_done(compressed_file_curl_part_t* part, CURLcode result)
+{
+	compressed_file_curl_t* file = part->file;
+	long code;
+
+	if (result != CURLE_OK)
+	{
+		if (!file->stopped && !part->failed)
+		{
+			error(0, "%s: range %ld-%ld, curl error %d - %s", file->url, part->start, part->end - 1, result, curl_easy_strerror(result));
+		}
+		return FALSE;
+	}
+
+	if (curl_easy_getinfo(part->curl, CURLINFO_RESPONSE_CODE, &code) != CURLE_OK)
+	{
+		error(0, "curl_easy_getinfo(CURLINFO_RESPONSE_CODE) failed");
+		return FALSE;
+	}
+
+	if (code != 206)
+	{
+		error(0, "%s: range %ld-%ld, invalid status code %ld", file->url, part->start, part->end - 1, code);
+		return FALSE;
+	}
+
+	if (part->received != part->end - part->start)
+	{
+		error(0, "%s: range %ld-%ld, got %ld bytes", file->url, part->start, part->end - 1, part->received);
+		return FALSE;
+	}
+
+	part->state = CURL_PART_DONE;
+	return TRUE;
+}
+
+static bool_t
+compressed_file_curl_read_parallel(compressed_file_curl_t* file, long start, long end)
+{
+	compressed_file_curl_part_t* parts = file->parts;
+	compressed_file_curl_part_t* part;
+	CURLMsg* msg;
+	CURLM* multi;
+	bool_t result = FALSE;
+	long next = start;
+	int running;
+	int left;
+	int head;
+	int i;
+
+	multi = curl_multi_init();
+	if (multi == NULL)
+	{
+		error(0, "curl_multi_init failed");
+		return FALSE;
+	}
+
+	for (i = 0; i < file->part_count && next < end; i++)
+	{
+		if (!compressed_file_curl_part_start(multi, &parts[i], next, min(next + CURL_PART_SIZE, end)))
+		{
+			goto done;
+		}
+		next = parts[i].end;
+	}
+
+	head = 0;
+	file->head = &parts[0];
+
+	for (;;)
+	{
+		if (curl_multi_perform(multi, &running) != CURLM_OK)
+		{
+			error(0, "%s: curl_multi_perform failed", file->url);
+			goto done;
+		}
+
+		while ((msg = curl_multi_info_read(multi, &left)) != NULL)
+		{
+			if (msg->msg != CURLMSG_DONE)
+			{
+				continue;
+			}
+
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**)&part);
+			curl_multi_remove_handle(multi, part->curl);
+
+			if (!compressed_file_curl_part_done(part, msg->data.result))
+			{
+				goto done;
+			}
+		}
+
+		// pass the parts that are done in order, and start the next parts
+		while (file->head->state == CURL_PART_DONE)
+		{
+			part = file->head;
+			part->state = CURL_PART_IDLE;
+
+			if (next < end)
+			{
+				if (!compressed_file_curl_part_start(multi, part, next, min(next + CURL_PART_SIZE, end)))
+				{
+					goto done;
+				}
+				next = part->end;
+			}
+
+			head = (head + 1) % file->part_count;
+			file->head = &parts[head];
+
+			if (file->head->state == CURL_PART_IDLE)
+			{
+				// all parts were passed
+				result = TRUE;
+				goto done;
+			}
+
+			if (file->head->size > 0)
+			{
+				if (!file->handler(file->handler_ctx, file->head->buf, file->head->size))
+				{
+					file->stopped = TRUE;
+					goto done;
+				}
+				file->head->size = 0;
+			}
+		}
+
+		if (curl_multi_poll(multi, NULL, 0, CURL_POLL_TIMEOUT, NULL) != CURLM_OK)
+		{
+			error(0, "%s: curl_multi_poll failed", file->url);
+			goto done;
+		}
+	}
+
+done:
+
+	for (i = 0; i < file->part_count; i++)
+	{
+		if (parts[i].state == CURL_PART_ACTIVE)
+		{
+			curl_multi_remove_handle(multi, parts[i].curl);
+		}
+		parts[i].state = CURL_PART_IDLE;
+	}
+
+	curl_multi_cleanup(multi);
+	file->head = NULL;
+
+	return result;
+}
+
+static bool_t
+compressed_file_curl_init_parts(compressed_file_curl_t* file)
+{
+	int i;
+
+	file->parts = calloc(file->part_count, sizeof(file->parts[0]));
+	if (file->parts == NULL)
+	{
+		error(0, "calloc failed");
+		return FALSE;
+	}
+
+	for (i = 0; i < file->part_count; i++)
+	{
+		file->parts[i].file = file;
+
+		if (!compressed_file_curl_init_handle(file, &file->parts[i].curl, &file->parts[i].curl_ext))
+		{
+			compressed_file_curl_free_parts(file);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static bool_t
+compressed_file_curl_read(void* ctx, long start, long end, compressed_file_data_handler_t handler, void* handler_ctx)
+{
+	compressed_file_curl_t* file = ctx;
+	long size;
+
+	if (file->part_count <= 1)
+	{
+		return compressed_file_curl_read_single(file, start, end, handler, handler_ctx);
+	}
+
+	if (end <= 0)
+	{
+		size = compressed_file_curl_get_size(file);
+		if (size < 0)
+		{
+			// unknown size, can't split
+			return compressed_file_curl_read_single(file, start, end, handler, handler_ctx);
+		}
+		end = size;
+	}
+
+	if (end - start <= CURL_PART_SIZE)
+	{
+		return compressed_file_curl_read_single(file, start, end, handler, handler_ctx);
+	}
+
+	if (file->parts == NULL && !compressed_file_curl_init_parts(file))
+	{
+		return FALSE;
+	}
+
+	file->handler = handler;
+	file->handler_ctx = handler_ctx;
+	file->stopped = FALSE;
+
+	return compressed_file_curl_read_parallel(file, start, end);
+}
+
+static void
+compressed_file_curl_set_connections(void* ctx, int count)
+{
+	compressed_file_curl_t* file = ctx;
+
+	compressed_file_curl_free_parts(file);
+	file->part_count = count;
+}
+
+compressed_file_backend_t compressed_file_curl = {
+	"curl",
+	compressed_file_curl_open,
+	compressed_file_curl_read,
+	compressed_file_curl_get_size,
+	compressed_file_curl_set_connections,
+	compressed_file_curl_close,
+};
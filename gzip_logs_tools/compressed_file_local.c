@@ -0,0 +1,242 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "compressed_file_backend.h"
+
+typedef struct {
+	int fd;
+	bool_t seekable;
+	char* path;
+} compressed_file_local_t;
+
+/// common
+static bool_t
+compressed_file_fd_read(
+	compressed_file_local_t* file,
+	long start,
+	long end,
+	compressed_file_data_handler_t handler,
+	void* handler_ctx)
+{
+	u_char* buffer;
+	ssize_t size;
+	bool_t result = TRUE;
+	long pos;
+
+	buffer = malloc(LOCAL_INPUT_CHUNK_SIZE);
+	if (buffer == NULL)
+	{
+		error(0, "malloc failed");
+		return FALSE;
+	}
+
+	for (pos = start; end <= 0 || pos < end; pos += size)
+	{
+		size = end > 0 ? min(LOCAL_INPUT_CHUNK_SIZE, end - pos) : LOCAL_INPUT_CHUNK_SIZE;
+		size = file->seekable ? pread(file->fd, buffer, size, pos) : read(file->fd, buffer, size);
+		if (size < 0)
+		{
+			if (errno == EINTR)
+			{
+				size = 0;
+				continue;
+			}
+
+			error(errno, "%s: read failed", file->path);
+			result = FALSE;
+			break;
+		}
+
+		if (size == 0)
+		{
+			break;
+		}
+
+		if (!handler(handler_ctx, buffer, size))
+		{
+			result = FALSE;
+			break;
+		}
+	}
+
+	free(buffer);
+	return result;
+}
+
+static void
+compressed_file_fd_close(void* ctx)
+{
+	compressed_file_local_t* file = ctx;
+
+	if (file->fd > STDIN_FILENO)
+	{
+		close(file->fd);
+	}
+
+	free(file);
+}
+
+/// local
+/*
+	Regular files are mapped and passed to the handler in large chunks, falling back to pread
+	when the file can't be mapped. Other files (e.g. pipes) are read sequentially.
+*/
+static void*
+compressed_file_local_open(curl_ext_conf_t* conf, str_t* url)
+{
+	compressed_file_local_t* file;
+	struct stat st;
+
+	file = malloc(sizeof(*file) + url->len + 1);
+	if (file == NULL)
+	{
+		error(0, "malloc failed");
+		return NULL;
+	}
+
+	file->path = (char*)(file + 1);
+	memcpy(file->path, url->data, url->len);
+	file->path[url->len] = '\0';
+
+	file->fd = open(file->path, O_RDONLY);
+	if (file->fd == -1)
+	{
+		error(errno, "%s", file->path);
+		free(file);
+		return NULL;
+	}
+
+	file->seekable = fstat(file->fd, &st) == 0 && S_ISREG(st.st_mode);
+
+	return file;
+}
+
+static bool_t
+compressed_file_local_read(void* ctx, long start, long end, compressed_file_data_handler_t handler, void* handler_ctx)
+{
+	compressed_file_local_t* file = ctx;
+	struct stat st;
+	u_char* map;
+	bool_t result = TRUE;
+	size_t size;
+	long map_start;
+	long pos;
+
+	if (!file->seekable)
+	{
+		// Note: the range is ignored
+		return compressed_file_fd_read(file, start, end, handler, handler_ctx);
+	}
+
+	if (fstat(file->fd, &st) == -1)
+	{
+		error(errno, "%s: fstat failed", file->path);
+		return FALSE;
+	}
+
+	end = end > 0 ? min(end, st.st_size) : st.st_size;
+	if (start >= end)
+	{
+		return TRUE;
+	}
+
+	posix_fadvise(file->fd, start, end - start, POSIX_FADV_SEQUENTIAL);
+
+	// Note: the mapping must start at a page boundary
+	map_start = start & ~(sysconf(_SC_PAGESIZE) - 1);
+
+	map = mmap(NULL, end - map_start, PROT_READ, MAP_PRIVATE, file->fd, map_start);
+	if (map == MAP_FAILED)
+	{
+		return compressed_file_fd_read(file, start, end, handler, handler_ctx);
+	}
+
+	madvise(map, end - map_start, MADV_SEQUENTIAL);
+
+	for (pos = start; pos < end; pos += size)
+	{
+		size = min(LOCAL_INPUT_CHUNK_SIZE, end - pos);
+		if (!handler(handler_ctx, map + (pos - map_start), size))
+		{
+			result = FALSE;
+			break;
+		}
+	}
+
+	munmap(map, end - map_start);
+	return result;
+}
+
+static long
+compressed_file_local_get_size(void* ctx)
+{
+	compressed_file_local_t* file = ctx;
+	struct stat st;
+
+	if (!file->seekable || fstat(file->fd, &st) == -1)
+	{
+		return -1;
+	}
+
+	return st.st_size;
+}
+
+compressed_file_backend_t compressed_file_local = {
+	"local",
+	compressed_file_local_open,
+	compressed_file_local_read,
+	compressed_file_local_get_size,
+	NULL,
+	compressed_file_fd_close,
+};
+
+/// stdin
+static void*
+compressed_file_stdin_open(curl_ext_conf_t* conf, str_t* url)
+{
+	compressed_file_local_t* file;
+
+	file = malloc(sizeof(*file));
+	if (file == NULL)
+	{
+		error(0, "malloc failed");
+		return NULL;
+	}
+
+	file->fd = STDIN_FILENO;
+	file->seekable = FALSE;
+	file->path = "stdin";
+
+	return file;
+}
+
+static bool_t
+compressed_file_stdin_read(void* ctx, long start, long end, compressed_file_data_handler_t handler, void* handler_ctx)
+{
+	if (start != 0 || end != 0)
+	{
+		error(0, "stdin: ranges are not supported");
+		return FALSE;
+	}
+
+	return compressed_file_fd_read(ctx, start, end, handler, handler_ctx);
+}
+
+static long
+compressed_file_stdin_get_size(void* ctx)
+{
+	return -1;
+}
+
+compressed_file_backend_t compressed_file_stdin = {
+	"stdin",
+	compressed_file_stdin_open,
+	compressed_file_stdin_read,
+	compressed_file_stdin_get_size,
+	NULL,
+	compressed_file_fd_close,
+};
@@ -106,3 +106,13 @@ itp_read(itp_t* state, itp_buffer_t* buffer, bool_t wait)
 	
 	return TRUE;
 }
+
+void
+itp_free(itp_t* state)
+{
+	sem_destroy(&state->free_slot_sem);
+	sem_destroy(&state->data_avail_sem);
+
+	free(state->start);
+	state->start = NULL;
+}
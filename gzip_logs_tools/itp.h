@@ -3,7 +3,7 @@
 
 // includes
 #include <semaphore.h>
-#include "../common.h"
+#include "common.h"
 
 /*
 	ITP = Inter Thread Pipe
@@ -16,6 +16,7 @@ typedef struct {
 	u_char* ptr;
 	size_t size;
 	uint32_t flags;
+	void* data;			// optional, owned by the reader once the buffer is read
 } itp_buffer_t;
 
 typedef struct {
@@ -34,4 +35,6 @@ bool_t itp_write(itp_t* state, itp_buffer_t* buffer, bool_t wait);
 
 bool_t itp_read(itp_t* state, itp_buffer_t* buffer, bool_t wait);
 
+void itp_free(itp_t* state);
+
 #endif // __ITP_H__
@@ -1 +1 @@
-gcc -O2 -Wall -Wextra -Wno-unused-parameter -o log_compressor log_compressor.c itp.c buffer_pool.c -lz -pthread 
\ No newline at end of file
+gcc -O2 -Wall -Wextra -Wno-unused-parameter -o log_compressor log_compressor.c ../itp.c ../buffer_pool.c -lz -pthread 
\ No newline at end of file
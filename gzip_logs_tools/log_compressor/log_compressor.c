@@ -7,6 +7,9 @@
 #include <sys/stat.h>
 #include <sys/un.h>
 #include <pthread.h>
+#include <regex.h>
+#include <poll.h>
+#include <time.h>
 #include <limits.h>
 #include <signal.h>
 #include <stdlib.h>
@@ -18,8 +21,9 @@
 #include <zlib.h>
 #include <pwd.h>
 #include <grp.h>
-#include "buffer_pool.h"
-#include "itp.h"
+#include "../segment_index.h"
+#include "../buffer_pool.h"
+#include "../itp.h"
 
 
 // paths
@@ -30,17 +34,25 @@
 #define ARRAY_ELEMENTS(x) (sizeof(x) / sizeof(x[0]))
 
 // constants
-// Note: memory usage is roughly limited to BUFFER_SIZE_READ x ITP_SIZE_READER_TO_COMP + BUFFER_SIZE_COMP x ITP_SIZE_COMP_TO_WRITER
+// Note: memory usage is roughly limited to (BUFFER_SIZE_READ x ITP_SIZE_READER_TO_COMP + BUFFER_SIZE_COMP x ITP_SIZE_COMP_TO_WRITER) x compressor count
 #define BUFFER_SIZE_READ (65536)
 #define BUFFER_SIZE_COMP (65536)
 #define ITP_SIZE_READER_TO_COMP (256)
 #define ITP_SIZE_COMP_TO_WRITER (256)
 #define MIN_READ_BUFFER_SIZE (16384)
 #define MAX_UNCOMP_SIZE_TILL_SYNC (64 * 1024 * 1024)
+#define PARALLEL_SEGMENT_SIZE (4 * 1024 * 1024)		// default uncompressed size of each gzip member when using multiple compressors
+#define MAX_COMPRESSOR_COUNT (64)
+#define INDEX_MAX_MATCH_LINES (16)		// max lines per buffer that are matched against the index regex
+#define INDEX_VALUE_SIZE (32)
+#define INDEX_RECORD_SIZE SEGMENT_INDEX_RECORD_SIZE(INDEX_VALUE_SIZE)
 
 #define FLAG_REOPEN_FILE	(0x1)
 #define FLAG_SHUTDOWN		(0x2)
+#define FLAG_END_MEMBER		(0x4)		// last buffer of a gzip member, the writer moves to the next compressor
+#define FLAG_LINE_START		(0x8)		// the buffer starts at the beginning of a line
 #define FLAG_FLUSH_MASK		(FLAG_REOPEN_FILE | FLAG_SHUTDOWN)
+#define FLAG_FINISH_MASK	(FLAG_FLUSH_MASK | FLAG_END_MEMBER)
 
 #define INOTIFY_BUF_LEN (10 * (sizeof(struct inotify_event) + NAME_MAX + 1))
 
@@ -55,16 +67,25 @@
 // typedefs
 typedef void *(*thread_func_t)(void *arg);
 
+typedef struct state_s state_t;
+
 typedef struct {
+	state_t* state;
+	itp_t reader_to_compressor;
+	itp_t compressor_to_writer;
+} compressor_t;
+
+struct state_s {
 	int input_fd;
 	int input_type;
 	int inotify_fd;
 	buffer_pool_t read_pool;
 	buffer_pool_t comp_pool;
-	itp_t reader_to_compressor;
-	itp_t compressor_to_writer;
+	compressor_t* compressors;		// gzip members are assigned to the compressors round robin
+	unsigned compressor_count;
 	const char* output_filename;
-} state_t;
+	char* index_filename;			// NULL = no segment index
+};
 
 enum {		// input types
 	IT_UNIX_DGRAM,
@@ -82,6 +103,13 @@ static int signals[] = {
 static volatile int reopen_files = 0;		// gets incremented on every REOPEN_SIGNAL signal
 static volatile int shutdown_signalled = 0;
 
+static unsigned compressor_count = 1;
+static size_t segment_max_size = 0;		// uncompressed bytes, 0 = close members only on MAX_UNCOMP_SIZE_TILL_SYNC
+static long segment_max_time = 0;		// seconds, 0 = no time limit
+
+static bool_t index_enabled = FALSE;
+static regex_t index_regex;
+
 static sem_t thread_error_sem;
 
 static FILE* log_file;
@@ -105,17 +133,288 @@ log_print(char *format, ...)
 	fflush(log_file);
 }
 
+static uint32_t
+get_trailer_checksum(const u_char* trailer)
+{
+	return trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | ((uint32_t)trailer[3] << 24);
+}
+
+static bool_t
+read_output_trailer(const char* path, off_t end_offset, u_char* trailer)
+{
+	bool_t result = FALSE;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+	{
+		log_print("read_output_trailer: open failed %d", errno);
+		return FALSE;
+	}
+
+	if (pread(fd, trailer, SEGMENT_INDEX_GZIP_TRAILER_SIZE, end_offset - SEGMENT_INDEX_GZIP_TRAILER_SIZE) != SEGMENT_INDEX_GZIP_TRAILER_SIZE)
+	{
+		log_print("read_output_trailer: pread failed %d", errno);
+		goto done;
+	}
+
+	result = TRUE;
+
+done:
+
+	close(fd);
+	return result;
+}
+
+static bool_t
+write_index_record(int fd, segment_index_header_t* header, segment_index_record_t* record, const u_char* trailer)
+{
+	if (write(fd, record, INDEX_RECORD_SIZE) != INDEX_RECORD_SIZE)
+	{
+		log_print("write_index_record: write failed %d", errno);
+		return FALSE;
+	}
+
+	// update the header after the record, readers ignore records beyond source_size
+	header->source_size = record->offset + record->size;
+	header->checksum = get_trailer_checksum(trailer);
+	if (pwrite(fd, header, sizeof(*header), 0) != sizeof(*header))
+	{
+		log_print("write_index_record: pwrite failed %d", errno);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static bool_t
+reset_index_file(int fd, segment_index_header_t* header)
+{
+	if (ftruncate(fd, sizeof(*header)) == -1)
+	{
+		log_print("reset_index_file: ftruncate failed %d", errno);
+		return FALSE;
+	}
+
+	header->source_size = 0;
+	header->checksum = 0;
+	if (pwrite(fd, header, sizeof(*header), 0) != sizeof(*header))
+	{
+		log_print("reset_index_file: pwrite failed %d", errno);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static bool_t
+index_matches_output(const char* output_path, segment_index_header_t* header, off_t output_size)
+{
+	u_char trailer[SEGMENT_INDEX_GZIP_TRAILER_SIZE];
+
+	// same as segment_index_check_source - the indexed data must be a prefix of the output file
+	if (header->source_size == 0)
+	{
+		return TRUE;
+	}
+
+	if ((uint64_t)output_size < header->source_size ||
+		header->source_size < sizeof(trailer))
+	{
+		return FALSE;
+	}
+
+	if (!read_output_trailer(output_path, header->source_size, trailer))
+	{
+		return FALSE;
+	}
+
+	return get_trailer_checksum(trailer) == header->checksum;
+}
+
+static bool_t
+drop_unconfirmed_records(int fd, segment_index_header_t* header, off_t file_size)
+{
+	segment_index_record_t record;
+	off_t end_offset;
+	off_t count;
+
+	// Note: records beyond source_size were written right before a crash, before the header was updated
+	count = (file_size - sizeof(*header)) / INDEX_RECORD_SIZE;
+	for (; count > 0; count--)
+	{
+		if (pread(fd, &record, sizeof(record), sizeof(*header) + (count - 1) * INDEX_RECORD_SIZE) != sizeof(record))
+		{
+			log_print("drop_unconfirmed_records: pread failed %d", errno);
+			return FALSE;
+		}
+
+		if (record.offset + record.size <= header->source_size)
+		{
+			break;
+		}
+	}
+
+	end_offset = sizeof(*header) + count * INDEX_RECORD_SIZE;
+	if (end_offset != file_size && ftruncate(fd, end_offset) == -1)
+	{
+		log_print("drop_unconfirmed_records: ftruncate failed %d", errno);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static bool_t
+write_index_gap(int fd, const char* output_path, segment_index_header_t* header, off_t output_size)
+{
+	u_char trailer[SEGMENT_INDEX_GZIP_TRAILER_SIZE];
+	segment_index_record_t* record;
+	bool_t result;
+
+	if (output_size < SEGMENT_INDEX_GZIP_TRAILER_SIZE ||
+		!read_output_trailer(output_path, output_size, trailer))
+	{
+		memset(trailer, 0, sizeof(trailer));
+	}
+
+	// Note: the values of the record are empty, readers must search the data it covers
+	record = calloc(1, INDEX_RECORD_SIZE);
+	if (record == NULL)
+	{
+		log_print("write_index_gap: calloc failed");
+		return FALSE;
+	}
+
+	record->offset = header->source_size;
+	record->size = output_size - header->source_size;
+
+	result = write_index_record(fd, header, record, trailer);
+
+	free(record);
+	return result;
+}
+
+static int
+open_index_file(const char* path, const char* output_path, segment_index_header_t* header, off_t output_size)
+{
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd == -1)
+	{
+		log_print("open_index_file: open failed %d", errno);
+		return -1;
+	}
+
+	if (fstat(fd, &st) == -1)
+	{
+		log_print("open_index_file: fstat failed %d", errno);
+		goto error;
+	}
+
+	if (st.st_size > 0)
+	{
+		if (pread(fd, header, sizeof(*header), 0) != sizeof(*header) ||
+			header->magic != SEGMENT_INDEX_MAGIC ||
+			header->version != SEGMENT_INDEX_VERSION ||
+			header->header_size != sizeof(*header) ||
+			header->record_size != INDEX_RECORD_SIZE)
+		{
+			log_print("open_index_file: incompatible index file %s", path);
+			goto error;
+		}
+
+		if (!index_matches_output(output_path, header, output_size))
+		{
+			// the gzip file was rotated / truncated / replaced, appending would mix the records of both files
+			log_print("open_index_file: index file %s does not match the output file, dropping the existing records", path);
+
+			if (!reset_index_file(fd, header))
+			{
+				goto error;
+			}
+		}
+		else if (!drop_unconfirmed_records(fd, header, st.st_size))
+		{
+			goto error;
+		}
+	}
+	else
+	{
+		memset(header, 0, sizeof(*header));
+		header->magic = SEGMENT_INDEX_MAGIC;
+		header->version = SEGMENT_INDEX_VERSION;
+		header->header_size = sizeof(*header);
+		header->record_size = INDEX_RECORD_SIZE;
+		header->value_size = INDEX_VALUE_SIZE;
+		if (write(fd, header, sizeof(*header)) != sizeof(*header))
+		{
+			log_print("open_index_file: write failed %d", errno);
+			goto error;
+		}
+	}
+
+	if (lseek(fd, 0, SEEK_END) == -1)
+	{
+		log_print("open_index_file: lseek failed %d", errno);
+		goto error;
+	}
+
+	// the output data that is not indexed (-i enabled on an existing file, or members written before a crash,
+	//	without their records) is covered by a gap record, so that the new records continue at the end of the file
+	if ((uint64_t)output_size > header->source_size)
+	{
+		log_print("open_index_file: %llu bytes of %s are not indexed",
+			(unsigned long long)(output_size - header->source_size), output_path);
+
+		if (!write_index_gap(fd, output_path, header, output_size))
+		{
+			goto error;
+		}
+	}
+
+	return fd;
+
+error:
+
+	close(fd);
+	return -1;
+}
+
+static void
+save_output_tail(u_char* tail, const u_char* data, size_t size)
+{
+	if (size >= SEGMENT_INDEX_GZIP_TRAILER_SIZE)
+	{
+		memcpy(tail, data + size - SEGMENT_INDEX_GZIP_TRAILER_SIZE, SEGMENT_INDEX_GZIP_TRAILER_SIZE);
+		return;
+	}
+
+	memmove(tail, tail + size, SEGMENT_INDEX_GZIP_TRAILER_SIZE - size);
+	memcpy(tail + SEGMENT_INDEX_GZIP_TRAILER_SIZE - size, data, size);
+}
+
 static void* 
 file_writer_thread(void* context)
 {
 	state_t* state = (state_t*)context;
+	compressor_t* compressor = state->compressors;
+	segment_index_header_t index_header;
+	segment_index_record_t* record;
 	itp_buffer_t input_buffer;
+	u_char output_tail[SEGMENT_INDEX_GZIP_TRAILER_SIZE];		// the gzip trailer of the last member
 	ssize_t bytes_written;
+	off_t output_offset = 0;
+	off_t member_offset = 0;
 	int output_fd = -1;
+	int index_fd = -1;
 
 	for (;;)
 	{
-		if (!itp_read(&state->compressor_to_writer, &input_buffer, TRUE))
+		// Note: reading the compressors in the same order the reader feeds them keeps the gzip members in input order
+		if (!itp_read(&compressor->compressor_to_writer, &input_buffer, TRUE))
 		{
 			log_print("file_writer_thread: itp_read failed");
 			goto error;
@@ -135,6 +434,15 @@ file_writer_thread(void* context)
 					log_print("file_writer_thread: open failed %d", errno);
 					goto error;
 				}
+
+				if (state->index_filename != NULL)
+				{
+					output_offset = lseek(output_fd, 0, SEEK_END);
+					member_offset = output_offset;
+
+					// failing to open the index is not fatal, the gzip file is written anyway
+					index_fd = open_index_file(state->index_filename, state->output_filename, &index_header, output_offset);
+				}
 			}
 		}
 				
@@ -144,9 +452,40 @@ file_writer_thread(void* context)
 			log_print("write failed %d", errno);
 			// may happen in case of disk full, just retry next time (the file can get corrupted of course)
 		}
+
+		if (bytes_written > 0)
+		{
+			output_offset += bytes_written;
+			save_output_tail(output_tail, input_buffer.ptr, bytes_written);
+		}
 		
 		buffer_pool_free(&state->comp_pool, input_buffer.ptr);
+
+		if (input_buffer.data != NULL)
+		{
+			// the member ended, write its index record
+			record = input_buffer.data;
+			record->offset = member_offset;
+			record->size = output_offset - member_offset;
+			member_offset = output_offset;
+
+			if (index_fd != -1)
+			{
+				write_index_record(index_fd, &index_header, record, output_tail);
+			}
+
+			free(record);
+		}
 		
+		if ((input_buffer.flags & FLAG_END_MEMBER) != 0)
+		{
+			compressor++;
+			if (compressor >= state->compressors + state->compressor_count)
+			{
+				compressor = state->compressors;
+			}
+		}
+
 		if ((input_buffer.flags & FLAG_FLUSH_MASK) != 0)
 		{
 			if (output_fd != STDOUT_FILENO)
@@ -154,6 +493,12 @@ file_writer_thread(void* context)
 				close(output_fd);
 				output_fd = -1;
 			}
+
+			if (index_fd != -1)
+			{
+				close(index_fd);
+				index_fd = -1;
+			}
 			
 			if ((input_buffer.flags & FLAG_SHUTDOWN) != 0)
 			{
@@ -180,10 +525,97 @@ zlib_free(void *opaque, void *address)
 	free(address);
 }
 
+static bool_t
+index_match_line(const u_char* line, size_t len, char* value)
+{
+	regmatch_t matches[2];
+	regmatch_t* match;
+	size_t value_len;
+
+	matches[0].rm_so = 0;
+	matches[0].rm_eo = len;
+	if (regexec(&index_regex, (const char*)line, array_entries(matches), matches, REG_STARTEND) != 0)
+	{
+		return FALSE;
+	}
+
+	// use the first capture if there is one, otherwise the whole match
+	match = index_regex.re_nsub > 0 && matches[1].rm_so != -1 ? &matches[1] : &matches[0];
+
+	value_len = min((size_t)(match->rm_eo - match->rm_so), INDEX_VALUE_SIZE - 1);
+	memcpy(value, line + match->rm_so, value_len);
+	memset(value + value_len, 0, INDEX_VALUE_SIZE - value_len);
+	return TRUE;
+}
+
+static void
+index_update_record(segment_index_record_t* record, const u_char* buffer, size_t size, bool_t line_start)
+{
+	const u_char* end = buffer + size;
+	const u_char* line;
+	const u_char* newline;
+	unsigned match_count = 0;
+
+	record->uncomp_size += size;
+
+	// count the lines, the first value is taken from the first complete line that matches
+	for (line = buffer; ; line = newline + 1)
+	{
+		newline = memchr(line, '\n', end - line);
+		if (newline == NULL)
+		{
+			break;
+		}
+
+		record->line_count++;
+
+		if (segment_index_min_value(record)[0] == '\0' && line_start && match_count < INDEX_MAX_MATCH_LINES)
+		{
+			index_match_line(line, newline - line, segment_index_min_value(record));
+			match_count++;
+		}
+
+		line_start = TRUE;
+	}
+
+	// the last value is taken from the last complete line that matches, going backwards
+	if (line == buffer)
+	{
+		return;		// no complete lines
+	}
+
+	newline = line - 1;
+	for (match_count = 0; match_count < INDEX_MAX_MATCH_LINES; match_count++)
+	{
+		line = memrchr(buffer, '\n', newline - buffer);
+		if (line != NULL)
+		{
+			line++;
+		}
+		else if (line_start)
+		{
+			line = buffer;
+		}
+		else
+		{
+			break;
+		}
+
+		if (index_match_line(line, newline - line, segment_index_max_value(record, INDEX_VALUE_SIZE)) || line == buffer)
+		{
+			break;
+		}
+
+		newline = line - 1;
+	}
+}
+
 static void* 
 compressor_thread(void* context)
 {
-	state_t* state = (state_t*)context;
+	compressor_t* compressor = (compressor_t*)context;
+	state_t* state = compressor->state;
+	segment_index_record_t* record = NULL;
 	z_stream zstream;
 	itp_buffer_t input_buffer;
 	itp_buffer_t output_buffer;
@@ -195,7 +627,7 @@ compressor_thread(void* context)
 
 	for (;;)
 	{
-		if (!itp_read(&state->reader_to_compressor, &input_buffer, TRUE))
+		if (!itp_read(&compressor->reader_to_compressor, &input_buffer, TRUE))
 		{
 			log_print("compressor_thread: itp_read failed");
 			goto error;
@@ -218,9 +650,24 @@ compressor_thread(void* context)
 			bytes_since_sync = 0;
 			
 			zstream_inited = TRUE;
+
+			if (state->index_filename != NULL)
+			{
+				record = calloc(1, INDEX_RECORD_SIZE);
+				if (record == NULL)
+				{
+					log_print("compressor_thread: calloc failed");
+					goto error;
+				}
+			}
+		}
+
+		if (record != NULL)
+		{
+			index_update_record(record, input_buffer.ptr, input_buffer.size, (input_buffer.flags & FLAG_LINE_START) != 0);
 		}
 		
-		flush = ((input_buffer.flags & FLAG_FLUSH_MASK) != 0 || bytes_since_sync > MAX_UNCOMP_SIZE_TILL_SYNC) ? Z_FINISH : Z_NO_FLUSH;
+		flush = ((input_buffer.flags & FLAG_FINISH_MASK) != 0 || bytes_since_sync > MAX_UNCOMP_SIZE_TILL_SYNC) ? Z_FINISH : Z_NO_FLUSH;
 		
 		zstream.next_in = input_buffer.ptr;
 		zstream.avail_in = input_buffer.size;
@@ -237,7 +684,8 @@ compressor_thread(void* context)
 					output_buffer.ptr = buffer;
 					output_buffer.size = BUFFER_SIZE_COMP;
 					output_buffer.flags = 0;
-					if (!itp_write(&state->compressor_to_writer, &output_buffer, TRUE))
+					output_buffer.data = NULL;
+					if (!itp_write(&compressor->compressor_to_writer, &output_buffer, TRUE))
 					{
 						log_print("compressor_thread: itp_write failed");
 						goto error;
@@ -269,13 +717,15 @@ compressor_thread(void* context)
 			output_buffer.ptr = buffer;
 			output_buffer.size = BUFFER_SIZE_COMP - zstream.avail_out;
 			output_buffer.flags = input_buffer.flags;
-			if (!itp_write(&state->compressor_to_writer, &output_buffer, TRUE))
+			output_buffer.data = record;		// the writer fills the offset and frees it
+			if (!itp_write(&compressor->compressor_to_writer, &output_buffer, TRUE))
 			{
 				log_print("compressor_thread: itp_write failed");
 				goto error;
 			}
 			
 			buffer = NULL;			
+			record = NULL;
 			
 			rc = deflateEnd(&zstream);
 			if (rc != Z_OK) 
@@ -301,10 +751,77 @@ error:
 	return NULL;
 }
 
+static long long
+get_monotonic_msec()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int
+reader_wait_for_data(int fd, long long deadline)
+{
+	struct pollfd pfd;
+	long long timeout;
+	int rc;
+
+	if (deadline == 0)
+	{
+		return 1;		// no open member, the caller can block
+	}
+
+	timeout = deadline - get_monotonic_msec();
+	if (timeout <= 0)
+	{
+		return 0;
+	}
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	rc = poll(&pfd, 1, (int)timeout);
+	if (rc < 0 && errno == EINTR)
+	{
+		return 0;
+	}
+
+	return rc;
+}
+
+static bool_t
+reader_shutdown_idle_compressors(state_t* state, compressor_t* cur_compressor)
+{
+	compressor_t* compressor;
+	itp_buffer_t output_buffer;
+
+	// the writer quits after getting the shutdown buffer of cur_compressor, the other compressors only need to exit
+	for (compressor = state->compressors; compressor < state->compressors + state->compressor_count; compressor++)
+	{
+		if (compressor == cur_compressor)
+		{
+			continue;
+		}
+
+		output_buffer.ptr = NULL;
+		output_buffer.size = 0;
+		output_buffer.flags = FLAG_SHUTDOWN;
+		output_buffer.data = NULL;
+		if (!itp_write(&compressor->reader_to_compressor, &output_buffer, TRUE))
+		{
+			log_print("reader_shutdown_idle_compressors: itp_write failed");
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
 static void* 
 reader_thread(void* context)
 {
 	state_t* state = (state_t*)context;
+	compressor_t* compressor = state->compressors;
 	ssize_t bytes_read;
 	u_char inotify_buffer[INOTIFY_BUF_LEN];
 	itp_buffer_t output_buffer;
@@ -312,7 +829,13 @@ reader_thread(void* context)
 	u_char* next_out;
 	bool_t wait = state->input_type == IT_FILE ? TRUE : FALSE;
 	size_t avail_out;
+	size_t member_size = 0;
+	long long member_deadline = 0;		// the time when the current member has to be closed, 0 = no pending data
+	bool_t member_expired;
+	bool_t line_start = TRUE;
+	bool_t next_line_start;
 	int last_reopen_files = 0;
+	int rc;
 
 	// allocate the first buffer
 	buffer = buffer_pool_alloc(&state->read_pool);
@@ -327,7 +850,9 @@ reader_thread(void* context)
 	
 	for (;;)
 	{
-		if (avail_out <= MIN_READ_BUFFER_SIZE || last_reopen_files != reopen_files || shutdown_signalled)
+		member_expired = member_deadline != 0 && get_monotonic_msec() >= member_deadline;
+
+		if (avail_out <= MIN_READ_BUFFER_SIZE || last_reopen_files != reopen_files || shutdown_signalled || member_expired)
 		{
 			// write the buffer
 			output_buffer.ptr = buffer;
@@ -340,18 +865,51 @@ reader_thread(void* context)
 			{
 				output_buffer.flags = (last_reopen_files != reopen_files) ? FLAG_REOPEN_FILE : 0;
 			}
+
+			if ((output_buffer.flags & FLAG_FLUSH_MASK) != 0 || member_expired ||
+				(segment_max_size != 0 && member_size + output_buffer.size >= segment_max_size))
+			{
+				output_buffer.flags |= FLAG_END_MEMBER;
+			}
+
+			if (line_start)
+			{
+				output_buffer.flags |= FLAG_LINE_START;
+			}
 			
-			if (itp_write(&state->reader_to_compressor, &output_buffer, wait))
+			output_buffer.data = NULL;
+
+			next_line_start = output_buffer.size > 0 ? buffer[output_buffer.size - 1] == '\n' : line_start;
+			
+			if (itp_write(&compressor->reader_to_compressor, &output_buffer, wait))
 			{
-				if (output_buffer.flags == FLAG_REOPEN_FILE)
+				member_size += output_buffer.size;
+
+				if ((output_buffer.flags & FLAG_REOPEN_FILE) != 0)
 				{
 					last_reopen_files = reopen_files;
 				}
-				else if (output_buffer.flags == FLAG_SHUTDOWN)
+				else if ((output_buffer.flags & FLAG_SHUTDOWN) != 0)
 				{
+					if (!reader_shutdown_idle_compressors(state, compressor))
+					{
+						goto error;
+					}
 					return NULL;
 				}
 
+				if ((output_buffer.flags & FLAG_END_MEMBER) != 0)
+				{
+					// the member is closed, move to the next compressor
+					compressor++;
+					if (compressor >= state->compressors + state->compressor_count)
+					{
+						compressor = state->compressors;
+					}
+					member_size = 0;
+					member_deadline = 0;
+				}
+
 				// buffer was sent, allocate a new one
 				buffer = buffer_pool_alloc(&state->read_pool);
 				if (buffer == NULL)
@@ -364,12 +922,35 @@ reader_thread(void* context)
 			{
 				// failed to write the buffer, just read over the current buffer, the data is lost
 				log_print("reader_thread: queue full, throwing buffer");
+
+				if (member_expired)
+				{
+					// retry closing the member after another period
+					member_deadline = get_monotonic_msec() + segment_max_time * 1000;
+				}
 			}
 			
+			line_start = next_line_start;
 			next_out = buffer;
 			avail_out = BUFFER_SIZE_READ;
 		}
 		
+		if (state->input_type == IT_UNIX_DGRAM)
+		{
+			// wake up when the member expires, even if no data arrives
+			rc = reader_wait_for_data(state->input_fd, member_deadline);
+			if (rc < 0)
+			{
+				log_print("reader_thread: poll failed %d", errno);
+				goto error;
+			}
+
+			if (rc == 0)
+			{
+				continue;
+			}
+		}
+
 		bytes_read = read(state->input_fd, next_out, avail_out);		
 		if (bytes_read <= 0)
 		{
@@ -391,6 +972,18 @@ reader_thread(void* context)
 				log_print("reader_thread: read returned no data while inotify is not initialized");
 				goto error;
 			}
+
+			rc = reader_wait_for_data(state->inotify_fd, member_deadline);
+			if (rc < 0)
+			{
+				log_print("reader_thread: poll inotify failed %d", errno);
+				goto error;
+			}
+
+			if (rc == 0)
+			{
+				continue;
+			}
 		
 			bytes_read = read(state->inotify_fd, inotify_buffer, INOTIFY_BUF_LEN);
 			if (bytes_read <= 0)
@@ -404,6 +997,11 @@ reader_thread(void* context)
 
 		next_out += bytes_read;
 		avail_out -= bytes_read;
+
+		if (member_deadline == 0 && segment_max_time != 0)
+		{
+			member_deadline = get_monotonic_msec() + segment_max_time * 1000;
+		}
 	}
 
 error:
@@ -674,6 +1272,7 @@ init_file(state_t* state, const char* path)
 static bool_t
 init_state(state_t* state, const char* input_owner, char *args)
 {
+	compressor_t* compressor;
 	char input_path[PATH_MAX];
 	char* colon_pos;
 	int input_type;
@@ -739,20 +1338,47 @@ init_state(state_t* state, const char* input_owner, char *args)
 		return FALSE;
 	}
 	
-	if (!itp_init(&state->reader_to_compressor, ITP_SIZE_READER_TO_COMP))
+	state->compressors = malloc(sizeof(state->compressors[0]) * compressor_count);
+	if (state->compressors == NULL)
 	{
-		log_print("init_state: itp_init failed (1)");
+		log_print("init_state: malloc failed");
 		return FALSE;
 	}
 
-	if (!itp_init(&state->compressor_to_writer, ITP_SIZE_COMP_TO_WRITER))
+	state->compressor_count = compressor_count;
+	
+	for (compressor = state->compressors; compressor < state->compressors + state->compressor_count; compressor++)
 	{
-		log_print("init_state: itp_init failed (2)");
-		return FALSE;
+		compressor->state = state;
+
+		if (!itp_init(&compressor->reader_to_compressor, ITP_SIZE_READER_TO_COMP))
+		{
+			log_print("init_state: itp_init failed (1)");
+			return FALSE;
+		}
+
+		if (!itp_init(&compressor->compressor_to_writer, ITP_SIZE_COMP_TO_WRITER))
+		{
+			log_print("init_state: itp_init failed (2)");
+			return FALSE;
+		}
 	}
 	
 	state->output_filename = colon_pos + 1;
 	state->input_type = input_type;
+
+	state->index_filename = NULL;
+	if (index_enabled && strcmp(state->output_filename, ".gz") != 0)
+	{
+		state->index_filename = malloc(strlen(state->output_filename) + sizeof(SEGMENT_INDEX_FILE_EXT));
+		if (state->index_filename == NULL)
+		{
+			log_print("init_state: malloc failed (2)");
+			return FALSE;
+		}
+
+		sprintf(state->index_filename, "%s%s", state->output_filename, SEGMENT_INDEX_FILE_EXT);
+	}
 	
 	return TRUE;
 }
@@ -814,14 +1440,46 @@ create_pid_file(const char *pid_file)
 static thread_func_t threads[] = {
 	file_writer_thread,
 	reader_thread,
-	compressor_thread,
 };
 
+#define STATE_THREAD_COUNT (ARRAY_ELEMENTS(threads) + compressor_count)
+
+static bool_t
+create_state_threads(state_t* state, pthread_t* tinfos)
+{
+	compressor_t* compressor;
+	unsigned thread_index;
+	int rc;
+
+	for (thread_index = 0; thread_index < ARRAY_ELEMENTS(threads); thread_index++)
+	{
+		rc = pthread_create(tinfos, NULL, threads[thread_index], state);
+		if (rc != 0)
+		{
+			log_print("create_state_threads: pthread_create failed %d", rc);
+			return FALSE;
+		}
+		tinfos++;
+	}
+
+	for (compressor = state->compressors; compressor < state->compressors + state->compressor_count; compressor++)
+	{
+		rc = pthread_create(tinfos, NULL, compressor_thread, compressor);
+		if (rc != 0)
+		{
+			log_print("create_state_threads: pthread_create failed %d", rc);
+			return FALSE;
+		}
+		tinfos++;
+	}
+
+	return TRUE;
+}
+
 static bool_t
 file_mode_main(const char* path)
 {
-	pthread_t* cur_tinfo;
-	pthread_t tinfos[ARRAY_ELEMENTS(threads)];
+	pthread_t* tinfos;
 	state_t state;
 	size_t path_len = strlen(path);
 	unsigned thread_index;
@@ -853,16 +1511,16 @@ file_mode_main(const char* path)
 		return FALSE;
 	}
 
-	cur_tinfo = tinfos;
-	for (thread_index = 0; thread_index < ARRAY_ELEMENTS(threads); thread_index++)
+	tinfos = malloc(sizeof(tinfos[0]) * STATE_THREAD_COUNT);
+	if (tinfos == NULL)
 	{
-		rc = pthread_create(cur_tinfo, NULL, threads[thread_index], &state);
-		if (rc != 0)
-		{
-			log_print("main_thread: pthread_create failed %d", rc);
-			return FALSE;
-		}
-		cur_tinfo++;
+		log_print("main_thread: malloc failed");
+		return FALSE;
+	}
+
+	if (!create_state_threads(&state, tinfos))
+	{
+		return FALSE;
 	}
 	
 	rc = sem_wait(&thread_error_sem);
@@ -874,7 +1532,7 @@ file_mode_main(const char* path)
 	
 	if (shutdown_signalled)
 	{
-		for (thread_index = 0; thread_index < ARRAY_ELEMENTS(threads); thread_index++)
+		for (thread_index = 0; thread_index < STATE_THREAD_COUNT; thread_index++)
 		{
 			pthread_join(tinfos[thread_index], NULL);
 		}
@@ -892,7 +1550,6 @@ main_thread(int argc, char *argv[])
 {
 	pthread_t sig_thread_info;
 	pthread_t* tinfos;
-	pthread_t* cur_tinfo;
 	sigset_t set;
 	state_t* states;
 	unsigned thread_index;
@@ -952,7 +1609,7 @@ main_thread(int argc, char *argv[])
 	}
 
 	// create threads
-	thread_count = watched_inputs * ARRAY_ELEMENTS(threads);
+	thread_count = watched_inputs * STATE_THREAD_COUNT;
 	tinfos = malloc(sizeof(tinfos[0]) * thread_count);
 	if (tinfos == NULL)
 	{
@@ -960,18 +1617,11 @@ main_thread(int argc, char *argv[])
 		return FALSE;
 	}
 	
-	cur_tinfo = tinfos;
 	for (arg_index = 0; arg_index < watched_inputs; arg_index++)
 	{
-		for (thread_index = 0; thread_index < ARRAY_ELEMENTS(threads); thread_index++)
+		if (!create_state_threads(&states[arg_index], tinfos + arg_index * STATE_THREAD_COUNT))
 		{
-			rc = pthread_create(cur_tinfo, NULL, threads[thread_index], &states[arg_index]);
-			if (rc != 0)
-			{
-				log_print("main_thread: pthread_create failed %d", rc);
-				return FALSE;
-			}
-			cur_tinfo++;
+			return FALSE;
 		}
 	}
 	
@@ -1002,11 +1652,106 @@ main_thread(int argc, char *argv[])
 	return TRUE;
 }
 
+static bool_t
+parse_positive_int(const char* name, const char* str, long* result)
+{
+	char* end;
+
+	*result = strtol(str, &end, 10);
+	if (*end != '\0' || *result <= 0)
+	{
+		printf("main: invalid value %s for option %s\n", str, name);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static bool_t
+parse_options(int* argc, char*** argv)
+{
+	const char* name;
+	const char* str;
+	char error_str[128];
+	long value;
+	int rc;
+
+	while (*argc >= 3 && (*argv)[1][0] == '-' && strcmp((*argv)[1], "-f") != 0)
+	{
+		name = (*argv)[1];
+		str = (*argv)[2];
+
+		if (strcmp(name, "-j") == 0)
+		{
+			if (!parse_positive_int(name, str, &value))
+			{
+				return FALSE;
+			}
+
+			if (value > MAX_COMPRESSOR_COUNT)
+			{
+				printf("main: compressor count %ld exceeds the limit %d\n", value, MAX_COMPRESSOR_COUNT);
+				return FALSE;
+			}
+			compressor_count = value;
+		}
+		else if (strcmp(name, "-m") == 0)
+		{
+			if (!parse_positive_int(name, str, &value))
+			{
+				return FALSE;
+			}
+			segment_max_size = (size_t)value * 1024 * 1024;
+		}
+		else if (strcmp(name, "-s") == 0)
+		{
+			if (!parse_positive_int(name, str, &value))
+			{
+				return FALSE;
+			}
+			segment_max_time = value;
+		}
+		else if (strcmp(name, "-i") == 0)
+		{
+			rc = regcomp(&index_regex, str, REG_EXTENDED);
+			if (rc != 0)
+			{
+				regerror(rc, &index_regex, error_str, sizeof(error_str));
+				printf("main: failed to compile index regex \"%s\": %s\n", str, error_str);
+				return FALSE;
+			}
+			index_enabled = TRUE;
+		}
+		else
+		{
+			printf("main: unknown option %s\n", name);
+			return FALSE;
+		}
+
+		// remove the option from the arg list, keeping the program name
+		(*argv)[2] = (*argv)[0];
+		*argv += 2;
+		*argc -= 2;
+	}
+
+	return TRUE;
+}
+
 int 
 main(int argc, char *argv[])
 {
 	pid_t pid, sid;
 
+	if (!parse_options(&argc, &argv))
+	{
+		return 1;
+	}
+
+	if (segment_max_size == 0 && compressor_count > 1)
+	{
+		segment_max_size = PARALLEL_SEGMENT_SIZE;
+	}
+
 	if (argc == 1 && !isatty(STDOUT_FILENO))
 	{
 		return file_mode_main("") ? 0 : 1;
@@ -1017,9 +1762,18 @@ main(int argc, char *argv[])
 	{
 		printf("Usage:\n\
   daemon mode:\n\
-    log_compressor <owner> <input file>:<output file> [ <input file>:<output file> [ ... ] ]\n\
+    log_compressor [ <options> ] <owner> <input file>:<output file> [ <input file>:<output file> [ ... ] ]\n\
   file mode:\n\
-    log_compressor -f <input file>\n");
+    log_compressor [ <options> ] -f <input file>\n\
+  options:\n\
+    -j <count>  number of compressor threads per input, when greater than 1, the output\n\
+                is split to gzip members (%d MB by default) that are compressed in parallel\n\
+    -m <mb>     close the gzip member after the given uncompressed size\n\
+    -s <secs>   close the gzip member the given number of seconds after its first data\n\
+                was read, the first of -m / -s that is reached closes the member\n\
+    -i <regex>  write a segment index to <output file>.idx, the first capture of the\n\
+                (extended) regex, or the whole match, is saved as the first / last\n\
+                value of each gzip member\n", PARALLEL_SEGMENT_SIZE / (1024 * 1024));
 		return 1;
 	}
     
@@ -0,0 +1,76 @@
+// includes
+#include "pcre_ext.h"
+
+// constants
+#define JIT_STACK_MIN_SIZE (32 * 1024)
+#define JIT_STACK_MAX_SIZE (1024 * 1024)
+
+#ifndef PCRE_ERROR_JIT_STACKLIMIT
+#define PCRE_ERROR_JIT_STACKLIMIT (-27)
+#endif
+
+// globals
+static __thread pcre_jit_stack* jit_stack = NULL;
+
+static pcre_jit_stack*
+pcre_ext_get_jit_stack(void* data)
+{
+	// Note: when the allocation fails, pcre uses 32K of the machine stack
+	if (jit_stack == NULL)
+	{
+		jit_stack = pcre_jit_stack_alloc(JIT_STACK_MIN_SIZE, JIT_STACK_MAX_SIZE);
+	}
+
+	return jit_stack;
+}
+
+pcre_extra*
+pcre_ext_study(pcre* code, const char** errstr)
+{
+	pcre_extra* extra;
+
+	extra = pcre_study(code, PCRE_STUDY_JIT_COMPILE, errstr);
+	if (extra != NULL && (extra->flags & PCRE_EXTRA_EXECUTABLE_JIT) != 0)
+	{
+		pcre_assign_jit_stack(extra, &pcre_ext_get_jit_stack, NULL);
+	}
+
+	return extra;
+}
+
+int
+pcre_ext_exec(
+	const pcre* code,
+	const pcre_extra* extra,
+	const char* subject,
+	int length,
+	int start_offset,
+	int options,
+	int* ovector,
+	int ovecsize)
+{
+	pcre_extra no_jit;
+	int rc;
+
+	rc = pcre_exec(code, extra, subject, length, start_offset, options, ovector, ovecsize);
+	if (rc != PCRE_ERROR_JIT_STACKLIMIT || extra == NULL)
+	{
+		return rc;
+	}
+
+	// the jit stack is too small for this subject, use the interpreter
+	no_jit = *extra;
+	no_jit.flags &= ~PCRE_EXTRA_EXECUTABLE_JIT;
+
+	return pcre_exec(code, &no_jit, subject, length, start_offset, options, ovector, ovecsize);
+}
+
+void
+pcre_ext_thread_cleanup()
+{
+	if (jit_stack != NULL)
+	{
+		pcre_jit_stack_free(jit_stack);
+		jit_stack = NULL;
+	}
+}
@@ -0,0 +1,29 @@
+#ifndef __PCRE_EXT_H__
+#define __PCRE_EXT_H__
+
+// includes
+#include <pcre.h>
+
+/*
+	JIT matching for pcre - the patterns are studied with PCRE_STUDY_JIT_COMPILE, and matched
+	with a JIT stack that is allocated once per thread, on first use.
+	The JIT is used only when supported by the pcre library. A match that runs out of JIT stack
+	is retried with the interpreter, so that the results do not depend on the engine.
+*/
+
+// functions
+pcre_extra* pcre_ext_study(pcre* code, const char** errstr);
+
+int pcre_ext_exec(
+	const pcre* code,
+	const pcre_extra* extra,
+	const char* subject,
+	int length,
+	int start_offset,
+	int options,
+	int* ovector,
+	int ovecsize);
+
+void pcre_ext_thread_cleanup();
+
+#endif // __PCRE_EXT_H__
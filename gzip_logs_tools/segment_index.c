@@ -0,0 +1,277 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include "segment_index.h"
+
+// constants
+#define TEXT_INDEX_MIN_VALUE_SIZE (8)
+
+static bool_t
+segment_index_load_binary(segment_index_t* index, const char* path, int fd, size_t size)
+{
+	segment_index_header_t* header;
+	segment_index_record_t* record;
+
+	index->map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (index->map == MAP_FAILED)
+	{
+		index->map = NULL;
+		error(errno, "%s: mmap failed", path);
+		return FALSE;
+	}
+
+	index->map_size = size;
+
+	header = index->map;
+	if (header->version != SEGMENT_INDEX_VERSION ||
+		header->header_size < sizeof(*header) ||
+		header->header_size > size ||
+		header->value_size == 0 ||
+		header->record_size != SEGMENT_INDEX_RECORD_SIZE(header->value_size))
+	{
+		error(0, "%s: unsupported index version %u", path, header->version);
+		return FALSE;
+	}
+
+	index->records = (char*)index->map + header->header_size;
+	index->count = (size - header->header_size) / header->record_size;
+	index->record_size = header->record_size;
+	index->value_size = header->value_size;
+	index->source_size = header->source_size;
+	index->checksum = header->checksum;
+
+	// ignore records that were appended after the header was last updated
+	while (index->count > 0)
+	{
+		record = segment_index_record(index, index->count - 1);
+		if (record->offset + record->size <= index->source_size)
+		{
+			break;
+		}
+		index->count--;
+	}
+
+	return TRUE;
+}
+
+static bool_t
+segment_index_parse_line(char* line, long* start, long* end, char** min_value, char** max_value)
+{
+	char* tab;
+	int pos;
+
+	// <start offset>\t<end offset>\t<min value>\t<max value>
+	if (sscanf(line, "%ld\t%ld\t%n", start, end, &pos) != 2)
+	{
+		return FALSE;
+	}
+
+	*min_value = line + pos;
+	tab = strchr(*min_value, '\t');
+	if (tab == NULL)
+	{
+		return FALSE;
+	}
+
+	*tab = '\0';
+	*max_value = tab + 1;
+	return TRUE;
+}
+
+static bool_t
+segment_index_load_text(segment_index_t* index, const char* path, FILE* fp)
+{
+	segment_index_record_t* cur;
+	size_t line_size = 0;
+	size_t value_size;
+	size_t count = 0;
+	ssize_t line_len;
+	char* line = NULL;
+	char* min_value;
+	char* max_value;
+	long start;
+	long end;
+	int pass;
+
+	// parse the output of zgrepindex, the first pass gets the record count and the value size
+	value_size = TEXT_INDEX_MIN_VALUE_SIZE;
+	for (pass = 0; pass < 2; pass++)
+	{
+		for (;;)
+		{
+			line_len = getline(&line, &line_size, fp);
+			if (line_len < 0)
+			{
+				break;
+			}
+
+			if (line_len > 0 && line[line_len - 1] == '\n')
+			{
+				line[--line_len] = '\0';
+			}
+
+			if (!segment_index_parse_line(line, &start, &end, &min_value, &max_value))
+			{
+				error(0, "%s: invalid index line \"%s\"", path, line);
+				goto failed;
+			}
+
+			if (pass == 0)
+			{
+				count++;
+				value_size = max(value_size, strlen(min_value) + 1);
+				value_size = max(value_size, strlen(max_value) + 1);
+				continue;
+			}
+
+			if (index->count >= count)
+			{
+				break;		// the file changed between the passes
+			}
+
+			cur = segment_index_record(index, index->count++);
+			cur->offset = start;
+			cur->size = end - start;
+			strcpy(segment_index_min_value(cur), min_value);
+			strcpy(segment_index_max_value(cur, value_size), max_value);
+		}
+
+		if (pass == 0)
+		{
+			index->value_size = value_size;
+			index->record_size = SEGMENT_INDEX_RECORD_SIZE(value_size);
+			index->records = calloc(count, index->record_size);
+			if (index->records == NULL && count > 0)
+			{
+				error(0, "calloc failed");
+				goto failed;
+			}
+
+			rewind(fp);
+		}
+	}
+
+	free(line);
+	return TRUE;
+
+failed:
+
+	free(line);
+	return FALSE;
+}
+
+bool_t
+segment_index_load(segment_index_t* index, const char* path)
+{
+	struct stat st;
+	uint32_t magic;
+	FILE* fp;
+	bool_t result;
+
+	memset(index, 0, sizeof(*index));
+
+	fp = fopen(path, "rb");
+	if (fp == NULL)
+	{
+		error(errno, "%s", path);
+		return FALSE;
+	}
+
+	if (fstat(fileno(fp), &st) == -1)
+	{
+		error(errno, "%s", path);
+		fclose(fp);
+		return FALSE;
+	}
+
+	if (st.st_size >= (off_t)sizeof(segment_index_header_t) &&
+		fread(&magic, sizeof(magic), 1, fp) == 1 &&
+		magic == SEGMENT_INDEX_MAGIC)
+	{
+		result = segment_index_load_binary(index, path, fileno(fp), st.st_size);
+	}
+	else
+	{
+		rewind(fp);
+		result = segment_index_load_text(index, path, fp);
+	}
+
+	fclose(fp);
+
+	if (!result)
+	{
+		segment_index_free(index);
+	}
+
+	return result;
+}
+
+bool_t
+segment_index_check_source(segment_index_t* index, const char* path, int fd)
+{
+	uint8_t trailer[SEGMENT_INDEX_GZIP_TRAILER_SIZE];
+	struct stat st;
+	uint32_t crc;
+
+	if (index->source_size == 0)
+	{
+		return TRUE;		// text index, nothing to check
+	}
+
+	// Note: the bytes before the first indexed member are not described by the index
+	if (index->count > 0 && segment_index_record(index, 0)->offset != 0)
+	{
+		error(0, "%s: stale index, the index does not start at the beginning of the file", path);
+		return FALSE;
+	}
+
+	if (fstat(fd, &st) == -1)
+	{
+		error(errno, "%s", path);
+		return FALSE;
+	}
+
+	// Note: a file that grew is fine, the index covers its prefix
+	if ((uint64_t)st.st_size < index->source_size ||
+		index->source_size < sizeof(trailer))
+	{
+		error(0, "%s: stale index, the file is smaller than the indexed size %llu",
+			path, (unsigned long long)index->source_size);
+		return FALSE;
+	}
+
+	if (pread(fd, trailer, sizeof(trailer), index->source_size - sizeof(trailer)) != sizeof(trailer))
+	{
+		error(errno, "%s: pread failed", path);
+		return FALSE;
+	}
+
+	crc = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | ((uint32_t)trailer[3] << 24);
+	if (crc != index->checksum)
+	{
+		error(0, "%s: stale index, checksum mismatch", path);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void
+segment_index_free(segment_index_t* index)
+{
+	if (index->map != NULL)
+	{
+		munmap(index->map, index->map_size);
+	}
+	else
+	{
+		free(index->records);
+	}
+
+	memset(index, 0, sizeof(*index));
+}
@@ -0,0 +1,80 @@
+#ifndef __SEGMENT_INDEX_H__
+#define __SEGMENT_INDEX_H__
+
+// includes
+#include <stdint.h>
+#include "common.h"
+
+/*
+	Segment index - a binary file that maps the gzip members of a segmented-gzip
+	file to their uncompressed properties, saved as <gzip file>.idx
+	The file is a header followed by fixed size records, sorted by offset, so it
+	can be mmapped and bisected in place. The min / max values are stored inline
+	in each record, in slots of header.value_size bytes (log_compressor saves the
+	first / last values of each member, assuming the values are sorted).
+	Records can be appended while the gzip file is being written, the header is
+	updated after each record.
+	The header also identifies the gzip file - source_size is the size of the data
+	covered by the index, and checksum is the crc32 trailer of the last indexed
+	member (the 8 bytes before source_size). An index whose checksum does not match
+	the gzip file is stale, if the gzip file grew, the index is valid for its prefix.
+	An index whose first record does not start at offset 0 is also treated as stale, since
+	the data before it is not described by the index.
+	A record with empty min / max values is a gap - data that was not indexed, e.g. written
+	before the index was enabled, or before a crash, without its record. Readers must search
+	the data of a gap, and not skip over it.
+	segment_index_load also accepts the text output of zgrepindex.
+*/
+
+// constants
+#define SEGMENT_INDEX_MAGIC (0x58444953)		// SIDX
+#define SEGMENT_INDEX_VERSION (2)
+#define SEGMENT_INDEX_FILE_EXT ".idx"
+#define SEGMENT_INDEX_GZIP_TRAILER_SIZE (8)	// crc32 + isize
+
+// macros
+#define SEGMENT_INDEX_RECORD_SIZE(value_size) (sizeof(segment_index_record_t) + 2 * (value_size))
+
+#define segment_index_record(index, i)							\
+	((segment_index_record_t*)((char*)(index)->records + (i) * (index)->record_size))
+#define segment_index_min_value(record) ((record)->values)
+#define segment_index_max_value(record, value_size) ((record)->values + (value_size))
+
+// typedefs
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t record_size;
+	uint32_t value_size;		// size of each value slot, including the null terminator
+	uint32_t checksum;			// crc32 of the last indexed gzip member
+	uint64_t source_size;		// size of the gzip data covered by the index
+} segment_index_header_t;
+
+typedef struct {
+	uint64_t offset;			// compressed offset of the gzip member
+	uint64_t size;				// compressed size of the gzip member
+	uint64_t uncomp_size;
+	uint64_t line_count;
+	char values[];				// null terminated min value followed by max value, value_size bytes each
+} segment_index_record_t;
+
+typedef struct {
+	void* records;
+	size_t count;
+	size_t record_size;
+	size_t value_size;
+	uint64_t source_size;		// 0 = unknown (text index)
+	uint32_t checksum;
+	void* map;					// NULL when the records were parsed from a text index
+	size_t map_size;
+} segment_index_t;
+
+// functions
+bool_t segment_index_load(segment_index_t* index, const char* path);
+
+bool_t segment_index_check_source(segment_index_t* index, const char* path, int fd);
+
+void segment_index_free(segment_index_t* index);
+
+#endif // __SEGMENT_INDEX_H__
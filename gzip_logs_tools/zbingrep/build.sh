@@ -1 +1 @@
-gcc -O2 -Wall -o zbingrep zbingrep.c ../common.c -lz -lpcre
\ No newline at end of file
+gcc -O2 -Wall -o zbingrep zbingrep.c ../segment_index.c ../pcre_ext.c ../common.c -lz -lpcre
\ No newline at end of file
@@ -4,8 +4,9 @@
 #include <stdarg.h>
 #include <errno.h>
 #include <stdio.h>
-#include <pcre.h>
 #include <zlib.h>
+#include "../segment_index.h"
+#include "../pcre_ext.h"
 #include "../common.h"
 
 // macros
@@ -71,14 +72,17 @@ static size_t buffers_left = MAX_BUFFERS;
 static buffer_t* used_buffers = NULL;
 static buffer_t* free_buffers = NULL;
 
+static segment_index_t segment_index;
+
 // constants
-static char const short_options[] = "e:p:hH";
+static char const short_options[] = "e:p:x:hH";
 static struct option const long_options[] =
 {
   {"no-filename", no_argument, NULL, 'h'},
   {"with-filename", no_argument, NULL, 'H'},
   {"pattern", required_argument, NULL, 'p'},
   {"end", required_argument, NULL, 'e'},
+  {"index", required_argument, NULL, 'x'},
   {"help", no_argument, &show_help, 1},
   {0, 0, 0, 0}
 };
@@ -135,7 +139,7 @@ compare_first_match(u_char* start_pos, u_char* end_pos, string_t* compare)
 			continue;
 		}
 			
-		if (pcre_exec(
+		if (pcre_ext_exec(
 			regex.code, 
 			regex.extra, 
 			(const char *) cur_pos + 1, 
@@ -187,7 +191,7 @@ compare_last_match(u_char* start_pos, u_char* end_pos, string_t* compare)
 			continue;
 		}
 			
-		if (pcre_exec(
+		if (pcre_ext_exec(
 			regex.code, 
 			regex.extra, 
 			(const char *) cur_pos + 1, 
@@ -485,8 +489,10 @@ print_lines(FILE* source, string_t* prefix)
 	u_char* start_pos;
 	u_char* end_pos;
 	u_char* cur_pos;
+	u_char* carry_pos = out;
 	string_t* compare = &start_value;
 	size_t compare_len;
+	size_t carry_len = 0;
 	int captures[6];
 	int print = 0;
 	int rc;
@@ -538,6 +544,10 @@ print_lines(FILE* source, string_t* prefix)
 					{
 						error(0, "%s: no matching lines, start too big", file_name);
 					}
+					else
+					{
+						write_func(write_context, carry_pos, carry_len);
+					}
 					(void)inflateEnd(&strm);
 					return 0;
 				}
@@ -546,9 +556,10 @@ print_lines(FILE* source, string_t* prefix)
 			
 			do 
 			{
-				// inflate as much as possible
-				strm.avail_out = CHUNK_SIZE_COMP;
-				strm.next_out = out;
+				// inflate as much as possible, after the last line of the previous chunk
+				memmove(out, carry_pos, carry_len);
+				strm.avail_out = CHUNK_SIZE_COMP - carry_len;
+				strm.next_out = out + carry_len;
 
 				rc = inflate(&strm, Z_NO_FLUSH);
 				switch (rc) 
@@ -563,6 +574,18 @@ print_lines(FILE* source, string_t* prefix)
 				cur_pos = out;
 				end_pos = out + CHUNK_SIZE_COMP - strm.avail_out;
 
+				// Note: the last line of the chunk may be truncated, and a truncated value that is a prefix of
+				//	the start / end value compares as equal. the line is moved (with the newline that precedes it)
+				//	to the next chunk, so that only complete lines are compared.
+				for (carry_pos = end_pos - 1; carry_pos >= out && *carry_pos != '\n'; carry_pos--);
+
+				carry_len = 0;
+				if (carry_pos >= out && end_pos - carry_pos < CHUNK_SIZE_COMP / 2)
+				{
+					carry_len = end_pos - carry_pos;
+					end_pos = carry_pos;
+				}
+
 				// if the last line does not change the state, we can process the chunk as a whole
 				result = compare_last_match(cur_pos, end_pos, compare);
 				if (!print)
@@ -592,7 +615,7 @@ print_lines(FILE* source, string_t* prefix)
 					}
 						
 					// match the current line
-					if (pcre_exec(
+					if (pcre_ext_exec(
 						regex.code, 
 						regex.extra, 
 						(const char *) cur_pos + 1, 
@@ -665,53 +688,81 @@ print_lines(FILE* source, string_t* prefix)
 	}
 }
 
-static int 
-process_file(int file_name_prefix)
+static off_t
+index_search_start_offset()
+{
+	segment_index_record_t* record;
+	size_t left = 0;
+	size_t right = segment_index.count;
+	size_t mid;
+	size_t compare_len;
+	char* max_value;
+
+	// find the first segment whose max value is not less than the start value
+	// Note: the values of a gap record are empty, so it is never skipped
+	while (left < right)
+	{
+		mid = (left + right) / 2;
+
+		record = segment_index_record(&segment_index, mid);
+		max_value = segment_index_max_value(record, segment_index.value_size);
+		compare_len = min(strnlen(max_value, segment_index.value_size), start_value.len);
+		if (memcmp(max_value, start_value.data, compare_len) < 0)
+		{
+			left = mid + 1;
+		}
+		else
+		{
+			right = mid;
+		}
+	}
+
+	if (left == 0)
+	{
+		return 0;
+	}
+
+	// continue from the end of the last segment that is smaller than the start value, and not from the
+	//	offset of the next one - the data between the segments (if any) is not indexed and must be searched
+	record = segment_index_record(&segment_index, left - 1);
+	return record->offset + record->size;
+}
+
+static int
+search_start_offset(FILE *source, off_t* buffer_start_offset)
 {
 	compare_result_t result;
-	string_t prefix;
-	FILE *source;
-	off_t buffer_start_offset;
 	off_t limit = -1;
 	off_t left = 0;
 	off_t right;
 	off_t mid;
-	int status = 1;
-
-	// open the file
-	source = fopen(file_name, "rb");
-	if (source == NULL)
-	{
-		error(errno, "%s", file_name);
-		return 1;
-	}
 
 	// seek to the end
 	if (fseek(source, 0, SEEK_END) == -1)
 	{
 		error(errno, "%s", file_name);
-		goto error;
+		return 1;
 	}
 	
 	right = ftell(source);
 	if (right == -1)
 	{
 		error(errno, "%s", file_name);
-		goto error;
+		return 1;
 	}
 
 	// binary search for the start pattern
 	mid = (left + right) / 2;
 	while (left <= right)
 	{
-		result = compare_file_offset(source, mid, limit, &buffer_start_offset);
+		result = compare_file_offset(source, mid, limit, buffer_start_offset);
 	#if 0
-		printf("left=%ld right=%ld mid=%ld result=%d start=%ld\n", left, right, mid, result, buffer_start_offset);
+		printf("left=%ld right=%ld mid=%ld result=%d start=%ld\n", left, right, mid, result, *buffer_start_offset);
 	#endif
 		switch (result)
 		{
 		case COMPARE_ERROR:
-			goto error;
+			return 1;
 
 		case COMPARE_LIMIT:
 			left = mid + 1;
@@ -729,26 +780,56 @@ process_file(int file_name_prefix)
 
 		case COMPARE_LESS_THAN:
 			left = mid + 1;
-			limit = buffer_start_offset + 1;
+			limit = *buffer_start_offset + 1;
 			break;
 			
 		case COMPARE_EQUALS:
 		case COMPARE_GREATER_THAN:
-			right = buffer_start_offset - 1;
+			right = *buffer_start_offset - 1;
 			break;
 		}
 
 		mid = (left + right) / 2;
 	}
 	
-	// seek to the start of the zip chunk
+	// find the start of the zip chunk
 	if (left > 1)
 	{
-		compare_file_offset(source, left - 1, -1, &buffer_start_offset);
+		compare_file_offset(source, left - 1, -1, buffer_start_offset);
 	}
 	else
 	{
-		buffer_start_offset = 0;
+		*buffer_start_offset = 0;
+	}
+
+	return 0;
+}
+
+static int 
+process_file(int file_name_prefix)
+{
+	string_t prefix;
+	FILE *source;
+	off_t buffer_start_offset;
+	int status = 1;
+
+	// open the file
+	source = fopen(file_name, "rb");
+	if (source == NULL)
+	{
+		error(errno, "%s", file_name);
+		return 1;
+	}
+
+	if (segment_index.count > 0 &&
+		segment_index_check_source(&segment_index, file_name, fileno(source)))
+	{
+		// the index has the segment boundaries, no need to probe the file
+		buffer_start_offset = index_search_start_offset();
+	}
+	else if (search_start_offset(source, &buffer_start_offset) != 0)
+	{
+		goto error;
 	}
 	
 	if (fseek(source, buffer_start_offset, SEEK_SET) == -1)
@@ -802,6 +883,11 @@ Example: %s -p '(\\d{2}:\\d{2}:\\d{2})' '02:45:00' input.log.gz\n\
   -H, --with-filename       print the file name for each match\n\
   -h, --no-filename         suppress the file name prefix on output\n\
   -e, --end                 END value, defaults to START if not specified\n\
+  -x, --index               a segment index of FILE, either the output of\n\
+                            zgrepindex or an index written by log_compressor.\n\
+                            the search is performed on the index, instead of\n\
+                            on the file. a stale index is ignored. can be\n\
+                            used with a single FILE only.\n\
   -p, --pattern             a regular expression that captures the value\n\
                             that should be compared to START / END, \n\
                             for each line. \n\
@@ -815,6 +901,7 @@ int
 main(int argc, char **argv)
 {
 	char* pattern = "(.*)";
+	const char* index_file_name = NULL;
 	const char *errstr;
 	int prefix_mode = PM_UNDEFINED;
 	int erroff;
@@ -851,6 +938,10 @@ main(int argc, char **argv)
 				pattern = optarg;
 				break;
 
+			case 'x':
+				index_file_name = optarg;
+				break;
+
 			case 0:
 				// long options
 				break;
@@ -912,12 +1003,27 @@ main(int argc, char **argv)
 		return 1;
 	}
 
-	regex.extra = pcre_study(regex.code, 0, &errstr);
+	regex.extra = pcre_ext_study(regex.code, &errstr);
 	if (errstr != NULL) 
 	{
 		error(0, "pcre_study() failed: %s", errstr);
 	}
 	
+	// load the index
+	if (index_file_name != NULL)
+	{
+		if (argc - optind > 1)
+		{
+			error(0, "an index can be used with a single file only");
+			return 1;
+		}
+
+		if (!segment_index_load(&segment_index, index_file_name))
+		{
+			return 1;
+		}
+	}
+
 	// process the files
 	rc = 0;
 	while (optind < argc)
@@ -0,0 +1,354 @@
+/*
+	Standalone check of the vectorized substring search in filter.c -
+	1. compares the results of the sse2 / avx2 implementations against filter_strpos / filter_strcasepos
+		on random haystacks / needles (the haystacks are allocated with their exact size, so building
+		with -fsanitize=address also catches reads past the end of the haystack)
+	2. measures the throughput of each implementation on a log file (or on generated text)
+
+	usage: bench_strpos [-i fuzz iterations] [-r bench repeat] [log file]
+*/
+
+// includes
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+#include "filter.c"
+
+// constants
+#define FUZZ_DEFAULT_ITERATIONS (1000000)
+#define FUZZ_MAX_HAYSTACK (300)
+#define FUZZ_MAX_NEEDLE (24)
+#define BENCH_DEFAULT_REPEAT (5)
+#define BENCH_GENERATED_SIZE (64 * 1024 * 1024)
+#define BENCH_MAX_FILE_SIZE (256 * 1024 * 1024)
+
+// enums
+enum {
+	EXIT_ERROR = 2,
+};
+
+// typedefs
+typedef char* (*strpos_func_t)(str_t* haystack, str_t* needle, bool_t caseless);
+
+typedef struct {
+	const char* name;
+	strpos_func_t func;
+} strpos_impl_t;
+
+// globals
+static strpos_impl_t impls[] = {
+	{ "scalar", &filter_strpos_scalar },
+#ifdef FILTER_STRPOS_SIMD
+	{ "sse2", &filter_strpos_sse2 },
+	{ "avx2", &filter_strpos_avx2 },
+#endif // FILTER_STRPOS_SIMD
+};
+
+static const char* bench_needles[] = {
+	"Exception",				// rare
+	"GET /",					// frequent
+	"x",						// single char
+	"no such text in the log file",
+};
+
+static const char fuzz_alphabet[] = "aAbBzZ- \n\x80\xe9";
+
+static bool_t
+impl_supported(strpos_impl_t* impl)
+{
+#ifdef FILTER_STRPOS_SIMD
+	if (impl->func == &filter_strpos_avx2)
+	{
+		return __builtin_cpu_supports("avx2");
+	}
+#endif // FILTER_STRPOS_SIMD
+
+	return TRUE;
+}
+
+/// fuzz
+static void
+fuzz_fill(char* buf, size_t len)
+{
+	size_t i;
+
+	// Note: a small alphabet, in order to get many partial matches
+	for (i = 0; i < len; i++)
+	{
+		buf[i] = fuzz_alphabet[rand() % (sizeof(fuzz_alphabet) - 1)];
+	}
+}
+
+static bool_t
+fuzz_run(long iterations)
+{
+	char needle_buf[FUZZ_MAX_NEEDLE];
+	char* expected;
+	char* result;
+	str_t haystack;
+	str_t needle;
+	bool_t caseless;
+	size_t pos;
+	size_t i;
+	long failed = 0;
+	long found = 0;
+	long iter;
+
+	for (iter = 0; iter < iterations; iter++)
+	{
+		haystack.len = rand() % (FUZZ_MAX_HAYSTACK + 1);
+		haystack.data = malloc(haystack.len + 1);		// + 1 - avoid malloc(0)
+		if (haystack.data == NULL)
+		{
+			error(0, "malloc failed");
+			return FALSE;
+		}
+		fuzz_fill(haystack.data, haystack.len);
+
+		needle.len = 1 + rand() % FUZZ_MAX_NEEDLE;
+		needle.data = needle_buf;
+		if (haystack.len >= needle.len && rand() % 2)
+		{
+			// take the needle from the haystack, and flip the case of some of its chars
+			pos = rand() % (haystack.len - needle.len + 1);
+			memcpy(needle.data, haystack.data + pos, needle.len);
+			for (i = 0; i < needle.len; i++)
+			{
+				if (rand() % 4 == 0)
+				{
+					needle.data[i] = isupper((u_char)needle.data[i]) ?
+						tolower((u_char)needle.data[i]) : toupper((u_char)needle.data[i]);
+				}
+			}
+		}
+		else
+		{
+			fuzz_fill(needle.data, needle.len);
+		}
+
+		caseless = rand() % 2;
+		expected = filter_strpos_scalar(&haystack, &needle, caseless);
+		if (expected != NULL)
+		{
+			found++;
+		}
+
+		for (i = 1; i < sizeof(impls) / sizeof(impls[0]); i++)
+		{
+			if (!impl_supported(&impls[i]))
+			{
+				continue;
+			}
+
+			result = impls[i].func(&haystack, &needle, caseless);
+			if (result != expected)
+			{
+				error(0, "%s mismatch, caseless %d, haystack \"%.*s\", needle \"%.*s\", expected %ld, got %ld",
+					impls[i].name, caseless, (int)haystack.len, haystack.data, (int)needle.len, needle.data,
+					expected != NULL ? (long)(expected - haystack.data) : -1L,
+					result != NULL ? (long)(result - haystack.data) : -1L);
+				failed++;
+			}
+		}
+
+		free(haystack.data);
+	}
+
+	printf("fuzz: %ld iterations, %ld found, %ld mismatches\n", iterations, found, failed);
+	return failed == 0;
+}
+
+/// benchmark
+static bool_t
+bench_load(const char* path, str_t* text)
+{
+	static const char* lines[] = {
+		"127.0.0.1 - - [17/Oct/2026:00:00:00 +0000] \"GET /index.html HTTP/1.1\" 200 5120 \"-\" \"curl/8.0\"\n",
+		"2026-10-17 00:00:00.123 INFO  [main] request completed, status=200, duration=12ms\n",
+		"2026-10-17 00:00:00.456 WARN  [pool-2] slow upstream response, host=backend-3, duration=1500ms\n",
+	};
+	size_t line_len;
+	size_t i;
+	FILE* fp;
+
+	text->data = malloc(path != NULL ? BENCH_MAX_FILE_SIZE : BENCH_GENERATED_SIZE);
+	if (text->data == NULL)
+	{
+		error(0, "malloc failed");
+		return FALSE;
+	}
+
+	if (path != NULL)
+	{
+		fp = fopen(path, "rb");
+		if (fp == NULL)
+		{
+			error(errno, "fopen failed %s", path);
+			return FALSE;
+		}
+
+		text->len = fread(text->data, 1, BENCH_MAX_FILE_SIZE, fp);
+		fclose(fp);
+		return TRUE;
+	}
+
+	text->len = 0;
+	for (i = 0; ; i = (i * 7 + 1) % (sizeof(lines) / sizeof(lines[0])))
+	{
+		line_len = strlen(lines[i]);
+		if (text->len + line_len > BENCH_GENERATED_SIZE)
+		{
+			break;
+		}
+
+		memcpy(text->data + text->len, lines[i], line_len);
+		text->len += line_len;
+	}
+
+	return TRUE;
+}
+
+static double
+bench_get_time()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t
+bench_count(strpos_func_t func, str_t* text, str_t* needle, bool_t caseless)
+{
+	str_t cur = *text;
+	size_t count = 0;
+	char* pos;
+
+	// Note: the search is restarted after each match, the same way a filter runs on consecutive blocks
+	while ((pos = func(&cur, needle, caseless)) != NULL)
+	{
+		count++;
+		pos += needle->len;
+		cur.len -= pos - cur.data;
+		cur.data = pos;
+	}
+
+	return count;
+}
+
+static bool_t
+bench_run(str_t* text, int repeat)
+{
+	str_t needle;
+	size_t expected = 0;
+	size_t count;
+	double best;
+	double start;
+	double elapsed;
+	bool_t caseless;
+	bool_t result = TRUE;
+	size_t n;
+	size_t i;
+	int r;
+
+	printf("bench: %zu bytes, best of %d\n", text->len, repeat);
+
+	for (n = 0; n < sizeof(bench_needles) / sizeof(bench_needles[0]); n++)
+	{
+		needle.data = (char*)bench_needles[n];
+		needle.len = strlen(bench_needles[n]);
+
+		for (caseless = FALSE; caseless <= TRUE; caseless++)
+		{
+			for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++)
+			{
+				if (!impl_supported(&impls[i]))
+				{
+					continue;
+				}
+
+				best = 0;
+				for (r = 0; r < repeat; r++)
+				{
+					start = bench_get_time();
+					count = bench_count(impls[i].func, text, &needle, caseless);
+					elapsed = bench_get_time() - start;
+					if (r == 0 || elapsed < best)
+					{
+						best = elapsed;
+					}
+				}
+
+				if (i == 0)
+				{
+					expected = count;
+				}
+				else if (count != expected)
+				{
+					error(0, "%s count mismatch, needle \"%s\", expected %zu, got %zu",
+						impls[i].name, bench_needles[n], expected, count);
+					result = FALSE;
+				}
+
+				printf("  %-32s %-8s %-6s %10zu matches %8.0f MB/s\n",
+					bench_needles[n], caseless ? "caseless" : "case", impls[i].name, count,
+					text->len / best / (1024 * 1024));
+			}
+		}
+	}
+
+	return result;
+}
+
+int
+main(int argc, char **argv)
+{
+	long iterations = FUZZ_DEFAULT_ITERATIONS;
+	int repeat = BENCH_DEFAULT_REPEAT;
+	str_t text;
+	bool_t result;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "i:r:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'i':
+			iterations = atol(optarg);
+			break;
+
+		case 'r':
+			repeat = atoi(optarg);
+			if (repeat <= 0)
+			{
+				repeat = 1;
+			}
+			break;
+
+		default:
+			fprintf(stderr, "usage: %s [-i fuzz iterations] [-r bench repeat] [log file]\n", argv[0]);
+			return EXIT_ERROR;
+		}
+	}
+
+#ifdef FILTER_STRPOS_SIMD
+	__builtin_cpu_init();
+#endif // FILTER_STRPOS_SIMD
+	srand(1);
+
+	result = fuzz_run(iterations);
+
+	if (!bench_load(optind < argc ? argv[optind] : NULL, &text))
+	{
+		return EXIT_ERROR;
+	}
+
+	if (!bench_run(&text, repeat))
+	{
+		result = FALSE;
+	}
+
+	free(text.data);
+
+	return result ? 0 : 1;
+}
@@ -1 +1,2 @@
-gcc -g -O2 -Wall -DINI_MAX_LINE=4096 -o zblockgrep zblockgrep.c json_parser.c filter.c ../compressed_file.c ../curl_ext.c ../curl_ext_s3.c ../capture_expression.c ../common.c ../inih/ini.c -I../inih/ -lz -lpcre -lcurl -lcrypto -pthread
\ No newline at end of file
+gcc -g -O2 -Wall -DINI_MAX_LINE=4096 -o zblockgrep zblockgrep.c json_parser.c filter.c pool.c ../compressed_file.c ../compressed_file_local.c ../compressed_file_curl.c ../itp.c ../buffer_pool.c ../curl_ext.c ../curl_ext_s3.c ../capture_expression.c ../pcre_ext.c ../common.c ../inih/ini.c -I../inih/ -lz -lpcre -lcurl -lcrypto -pthread
+gcc -g -O2 -Wall -o bench_strpos bench_strpos.c json_parser.c pool.c ../pcre_ext.c ../common.c -lpcre
\ No newline at end of file
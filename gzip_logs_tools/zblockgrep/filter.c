@@ -2,7 +2,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
-#include <pcre.h>
+#include "../pcre_ext.h"
 #include "json_parser.h"
 #include "filter.h"
 
@@ -139,6 +139,153 @@ filter_get_json_object_bool_value(json_object_t* obj, const char* name, size_t n
 	return value->v.boolean;
 }
 
+/// simd substring search
+/*
+	Vectorized versions of filter_strpos / filter_strcasepos - the first and last chars of the
+	needle are compared against a block of haystack positions, and only the positions in which
+	both match are verified. In case insensitive search, the chars are compared against both
+	their lower and upper case forms (the tools run in the C locale, tolower is ascii only).
+	The implementation is selected at runtime according to the cpu features.
+*/
+#if defined(__x86_64__) && defined(__GNUC__)
+#define FILTER_STRPOS_SIMD
+#endif // __x86_64__ && __GNUC__
+
+static char*
+filter_strpos_tail(str_t* haystack, str_t* needle, size_t pos, bool_t caseless)
+{
+	str_t tail;
+
+	if (haystack->len < pos + needle->len)
+	{
+		return NULL;
+	}
+
+	tail.data = haystack->data + pos;
+	tail.len = haystack->len - pos;
+	return caseless ? filter_strcasepos(&tail, needle) : filter_strpos(&tail, needle);
+}
+
+static bool_t
+filter_strpos_verify(char* cur, str_t* needle, bool_t caseless)
+{
+	// Note: the first and last chars were already compared
+	if (needle->len <= 2)
+	{
+		return TRUE;
+	}
+
+	if (caseless)
+	{
+		return filter_memcasecmp(cur + 1, needle->data + 1, needle->len - 2) == 0;
+	}
+
+	return memcmp(cur + 1, needle->data + 1, needle->len - 2) == 0;
+}
+
+static char*
+filter_strpos_scalar(str_t* haystack, str_t* needle, bool_t caseless)
+{
+	return filter_strpos_tail(haystack, needle, 0, caseless);
+}
+
+#ifdef FILTER_STRPOS_SIMD
+#include <immintrin.h>
+
+static char*
+filter_strpos_sse2(str_t* haystack, str_t* needle, bool_t caseless)
+{
+	u_char first = needle->data[0];
+	u_char last = needle->data[needle->len - 1];
+	__m128i first_lower = _mm_set1_epi8(caseless ? tolower(first) : first);
+	__m128i first_upper = _mm_set1_epi8(caseless ? toupper(first) : first);
+	__m128i last_lower = _mm_set1_epi8(caseless ? tolower(last) : last);
+	__m128i last_upper = _mm_set1_epi8(caseless ? toupper(last) : last);
+	__m128i block_first;
+	__m128i block_last;
+	uint32_t mask;
+	size_t pos;
+	char* cur;
+
+	for (pos = 0; pos + needle->len - 1 + 16 <= haystack->len; pos += 16)
+	{
+		block_first = _mm_loadu_si128((const __m128i*)(haystack->data + pos));
+		block_last = _mm_loadu_si128((const __m128i*)(haystack->data + pos + needle->len - 1));
+
+		mask = _mm_movemask_epi8(_mm_and_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(block_first, first_lower), _mm_cmpeq_epi8(block_first, first_upper)),
+			_mm_or_si128(_mm_cmpeq_epi8(block_last, last_lower), _mm_cmpeq_epi8(block_last, last_upper))));
+
+		for (; mask != 0; mask &= mask - 1)
+		{
+			cur = haystack->data + pos + __builtin_ctz(mask);
+			if (filter_strpos_verify(cur, needle, caseless))
+			{
+				return cur;
+			}
+		}
+	}
+
+	return filter_strpos_tail(haystack, needle, pos, caseless);
+}
+
+__attribute__((target("avx2")))
+static char*
+filter_strpos_avx2(str_t* haystack, str_t* needle, bool_t caseless)
+{
+	u_char first = needle->data[0];
+	u_char last = needle->data[needle->len - 1];
+	__m256i first_lower = _mm256_set1_epi8(caseless ? tolower(first) : first);
+	__m256i first_upper = _mm256_set1_epi8(caseless ? toupper(first) : first);
+	__m256i last_lower = _mm256_set1_epi8(caseless ? tolower(last) : last);
+	__m256i last_upper = _mm256_set1_epi8(caseless ? toupper(last) : last);
+	__m256i block_first;
+	__m256i block_last;
+	uint32_t mask;
+	size_t pos;
+	char* cur;
+
+	for (pos = 0; pos + needle->len - 1 + 32 <= haystack->len; pos += 32)
+	{
+		block_first = _mm256_loadu_si256((const __m256i*)(haystack->data + pos));
+		block_last = _mm256_loadu_si256((const __m256i*)(haystack->data + pos + needle->len - 1));
+
+		mask = _mm256_movemask_epi8(_mm256_and_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(block_first, first_lower), _mm256_cmpeq_epi8(block_first, first_upper)),
+			_mm256_or_si256(_mm256_cmpeq_epi8(block_last, last_lower), _mm256_cmpeq_epi8(block_last, last_upper))));
+
+		for (; mask != 0; mask &= mask - 1)
+		{
+			cur = haystack->data + pos + __builtin_ctz(mask);
+			if (filter_strpos_verify(cur, needle, caseless))
+			{
+				return cur;
+			}
+		}
+	}
+
+	return filter_strpos_tail(haystack, needle, pos, caseless);
+}
+#endif // FILTER_STRPOS_SIMD
+
+static char* (*filter_strpos_impl)(str_t* haystack, str_t* needle, bool_t caseless) = &filter_strpos_scalar;
+
+static void
+filter_strpos_init()
+{
+#ifdef FILTER_STRPOS_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	{
+		filter_strpos_impl = &filter_strpos_avx2;
+	}
+	else
+	{
+		filter_strpos_impl = &filter_strpos_sse2;
+	}
+#endif // FILTER_STRPOS_SIMD
+}
+
 /// base filter
 typedef struct filter_parse_ctx_s filter_parse_ctx_t;
 typedef filter_base_t* (*filter_parse_func_t)(filter_parse_ctx_t* ctx, json_object_t* obj);
@@ -147,10 +294,16 @@ typedef bool_t (*filter_eval_func_t)(void* filter, str_t* block);
 struct filter_base_s
 {
 	filter_eval_func_t eval;
+	int cost;					// estimated evaluation cost, set by filter_optimize
+	filter_eval_func_t stats_eval;	// the original eval function, when stats are enabled
+	eval_stats_t stats;
+	size_t stream_index;			// leaves only, the index of the leaf in filter_stream_t
+	size_t stream_leaf_count;		// root only, the number of leaves
 };
 
 struct filter_parse_ctx_s 
 {
+	pool_t* pool;				// holds the whole filter tree
 	char* error;
 	size_t error_size;
 };
@@ -175,7 +328,7 @@ filter_match_eval(void* obj, str_t* block)
 {
 	filter_match_t* filter = obj;
 	
-	return filter_strpos(block, &filter->text) != NULL;
+	return filter_strpos_impl(block, &filter->text, FALSE) != NULL;
 }
 
 static bool_t 
@@ -183,7 +336,7 @@ filter_match_eval_case(void* obj, str_t* block)
 {
 	filter_match_t* filter = obj;
 	
-	return filter_strcasepos(block, &filter->text) != NULL;
+	return filter_strpos_impl(block, &filter->text, TRUE) != NULL;
 }
 
 static filter_base_t*
@@ -199,10 +352,10 @@ filter_match_parse(filter_parse_ctx_t* ctx, json_object_t* obj)
 		return NULL;
 	}
 	
-	filter = malloc(sizeof(*filter) + text->len);
+	filter = pool_alloc(ctx->pool, sizeof(*filter) + text->len);
 	if (filter == NULL)
 	{
-		snprintf(ctx->error, ctx->error_size, "match filter: malloc failed");
+		snprintf(ctx->error, ctx->error_size, "match filter: alloc failed");
 		return NULL;
 	}
 	
@@ -231,30 +384,288 @@ filter_match_parse(filter_parse_ctx_t* ctx, json_object_t* obj)
 	return &filter->base;
 }
 
+/// multi match filter
+/*
+	An or of match filters is evaluated with an Aho-Corasick automaton, so that the block is
+	scanned once, regardless of the number of needles. The automaton is a DFA over the chars
+	that appear in the needles (all other chars share a single class). When some needles are
+	case insensitive, the input is folded to lower case, and case sensitive needles are
+	verified on each match.
+*/
+#define MULTI_MATCH_MIN_NEEDLES (2)
+#define MULTI_MATCH_FLAG (0x80000000)		// set on transitions to states in which a needle ends
+#define MULTI_MATCH_NONE ((uint32_t)-1)
+
+typedef struct
+{
+	str_t text;
+	bool_t caseless;
+	int next;					// the next needle that ends in the same state, -1 = none
+} filter_multi_match_needle_t;
+
+typedef struct
+{
+	filter_base_t base;
+	uint16_t classes[256];		// input char -> alphabet index, 0 = a char that does not appear in the needles
+	size_t alphabet_size;
+	uint32_t* trans;			// state * alphabet_size + class -> next state * alphabet_size | MULTI_MATCH_FLAG
+	int* state_needles;			// state -> first needle that ends in the state, -1 = none
+	uint32_t* dict_links;		// state -> the next state in the failure chain in which a needle ends, 0 = none
+	filter_multi_match_needle_t* needles;
+	size_t needle_count;
+	bool_t verify;				// the input is folded, and some needles are case sensitive
+} filter_multi_match_t;
+
+static bool_t
+filter_multi_match_verify(filter_multi_match_t* filter, uint32_t state, str_t* block, u_char* match_end)
+{
+	filter_multi_match_needle_t* needle;
+	int index;
+
+	for (; state != 0; state = filter->dict_links[state])
+	{
+		for (index = filter->state_needles[state]; index >= 0; index = needle->next)
+		{
+			needle = &filter->needles[index];
+			if (needle->caseless ||
+				memcmp(match_end - needle->text.len, needle->text.data, needle->text.len) == 0)
+			{
+				return TRUE;
+			}
+		}
+	}
+
+	return FALSE;
+}
+
+static bool_t
+filter_multi_match_eval(void* obj, str_t* block)
+{
+	filter_multi_match_t* filter = obj;
+	uint32_t* trans = filter->trans;
+	uint16_t* classes = filter->classes;
+	u_char* cur = (u_char*)block->data;
+	u_char* end = cur + block->len;
+	uint32_t state = 0;
+	uint32_t next;
+
+	while (cur < end)
+	{
+		next = trans[state + classes[*cur++]];
+		state = next & ~MULTI_MATCH_FLAG;
+
+		if ((next & MULTI_MATCH_FLAG) != 0 &&
+			(!filter->verify ||
+			filter_multi_match_verify(filter, state / filter->alphabet_size, block, cur)))
+		{
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+static filter_base_t*
+filter_multi_match_create(filter_parse_ctx_t* ctx, filter_multi_match_needle_t* needles, size_t count)
+{
+	filter_multi_match_t* filter;
+	bool_t caseless = FALSE;
+	bool_t sensitive = FALSE;
+	uint32_t* fail = NULL;
+	uint32_t* queue = NULL;
+	uint32_t* trans;
+	uint32_t state_count;
+	uint32_t max_states;
+	uint32_t head;
+	uint32_t tail;
+	uint32_t cur;
+	uint32_t next;
+	uint32_t i;
+	size_t alphabet_size;
+	size_t j;
+	uint16_t class_map[256];
+	u_char fold[256];
+	u_char ch;
+	size_t c;
+
+	filter = pool_alloc(ctx->pool, sizeof(*filter));
+	if (filter == NULL)
+	{
+		goto alloc_failed;
+	}
+
+	// build the alphabet
+	max_states = 1;
+	for (i = 0; i < count; i++)
+	{
+		max_states += needles[i].text.len;
+		if (needles[i].caseless)
+		{
+			caseless = TRUE;
+		}
+		else
+		{
+			sensitive = TRUE;
+		}
+	}
+
+	for (c = 0; c < 256; c++)
+	{
+		fold[c] = caseless ? tolower(c) : c;
+	}
+
+	memset(class_map, 0, sizeof(class_map));
+	alphabet_size = 1;
+	for (i = 0; i < count; i++)
+	{
+		for (j = 0; j < needles[i].text.len; j++)
+		{
+			ch = fold[(u_char)needles[i].text.data[j]];
+			if (class_map[ch] == 0)
+			{
+				class_map[ch] = alphabet_size++;
+			}
+		}
+	}
+
+	if ((uint64_t)max_states * alphabet_size >= MULTI_MATCH_FLAG)
+	{
+		snprintf(ctx->error, ctx->error_size, "or filter: too many match filters");
+		return NULL;
+	}
+
+	for (c = 0; c < 256; c++)
+	{
+		filter->classes[c] = class_map[fold[c]];
+	}
+
+	filter->alphabet_size = alphabet_size;
+	filter->needles = needles;
+	filter->needle_count = count;
+	filter->verify = caseless && sensitive;
+
+	filter->trans = trans = pool_alloc(ctx->pool, sizeof(trans[0]) * max_states * alphabet_size);
+	filter->state_needles = pool_alloc(ctx->pool, sizeof(filter->state_needles[0]) * max_states);
+	filter->dict_links = pool_alloc(ctx->pool, sizeof(filter->dict_links[0]) * max_states);
+	fail = malloc(sizeof(fail[0]) * max_states);
+	queue = malloc(sizeof(queue[0]) * max_states);
+	if (trans == NULL || filter->state_needles == NULL || filter->dict_links == NULL ||
+		fail == NULL || queue == NULL)
+	{
+		goto alloc_failed;
+	}
+
+	memset(trans, 0xff, sizeof(trans[0]) * max_states * alphabet_size);		// MULTI_MATCH_NONE
+	memset(filter->dict_links, 0, sizeof(filter->dict_links[0]) * max_states);
+	memset(filter->state_needles, 0xff, sizeof(filter->state_needles[0]) * max_states);	// -1
+
+	// build the trie
+	state_count = 1;
+	for (i = 0; i < count; i++)
+	{
+		cur = 0;
+		for (j = 0; j < needles[i].text.len; j++)
+		{
+			c = filter->classes[(u_char)needles[i].text.data[j]];
+			if (trans[cur * alphabet_size + c] == MULTI_MATCH_NONE)
+			{
+				trans[cur * alphabet_size + c] = state_count++;
+			}
+			cur = trans[cur * alphabet_size + c];
+		}
+
+		needles[i].next = filter->state_needles[cur];
+		filter->state_needles[cur] = i;
+	}
+
+	// set the failure links and complete the transitions, in bfs order
+	head = tail = 0;
+	for (c = 0; c < alphabet_size; c++)
+	{
+		next = trans[c];
+		if (next == MULTI_MATCH_NONE)
+		{
+			trans[c] = 0;
+			continue;
+		}
+
+		fail[next] = 0;
+		queue[tail++] = next;
+	}
+
+	while (head < tail)
+	{
+		cur = queue[head++];
+		for (c = 0; c < alphabet_size; c++)
+		{
+			next = trans[cur * alphabet_size + c];
+			if (next == MULTI_MATCH_NONE)
+			{
+				trans[cur * alphabet_size + c] = trans[fail[cur] * alphabet_size + c];
+				continue;
+			}
+
+			fail[next] = trans[fail[cur] * alphabet_size + c];
+			filter->dict_links[next] = filter->state_needles[fail[next]] >= 0 ?
+				fail[next] : filter->dict_links[fail[next]];
+			queue[tail++] = next;
+		}
+	}
+
+	// convert the states to row offsets and flag the matching states
+	for (i = 0; i < state_count * alphabet_size; i++)
+	{
+		next = trans[i];
+		trans[i] = next * alphabet_size;
+		if (filter->state_needles[next] >= 0 || filter->dict_links[next] != 0)
+		{
+			trans[i] |= MULTI_MATCH_FLAG;
+		}
+	}
+
+	free(fail);
+	free(queue);
+
+	filter->base.eval = &filter_multi_match_eval;
+	return &filter->base;
+
+alloc_failed:
+
+	free(fail);
+	free(queue);
+	snprintf(ctx->error, ctx->error_size, "or filter: alloc failed");
+	return NULL;
+}
+
 /// regex filter
 typedef struct
 {
 	filter_base_t base;
 	pcre *code;
 	pcre_extra *extra;
+	const char* pattern;
 } filter_regex_t;
 
-static bool_t 
-filter_regex_eval(void* obj, str_t* block)
+static bool_t
+filter_regex_exec(filter_regex_t* filter, str_t* block, int options)
 {
-	filter_regex_t* filter = obj;
-	
-	return pcre_exec(
+	return pcre_ext_exec(
 		filter->code, 
 		filter->extra, 
 		(const char *)block->data, 
 		block->len, 
 		0, 
-		0, 
+		options, 
 		NULL, 
 		0) >= 0;
 }
 
+static bool_t 
+filter_regex_eval(void* obj, str_t* block)
+{
+	return filter_regex_exec(obj, block, 0);
+}
+
 static filter_base_t*
 filter_regex_parse(filter_parse_ctx_t* ctx, json_object_t* obj)
 {
@@ -272,10 +683,10 @@ filter_regex_parse(filter_parse_ctx_t* ctx, json_object_t* obj)
 		return NULL;
 	}
 	
-	pattern_dec.data = malloc(pattern->len + 1);
+	pattern_dec.data = pool_alloc(ctx->pool, pattern->len + 1);
 	if (pattern_dec.data == NULL)
 	{
-		snprintf(ctx->error, ctx->error_size, "regex filter: malloc failed");
+		snprintf(ctx->error, ctx->error_size, "regex filter: alloc failed");
 		return NULL;
 	}
 	pattern_dec.len = 0;
@@ -287,10 +698,10 @@ filter_regex_parse(filter_parse_ctx_t* ctx, json_object_t* obj)
 	}
 	pattern_dec.data[pattern_dec.len] = '\0';
 	
-	filter = malloc(sizeof(*filter));
+	filter = pool_alloc(ctx->pool, sizeof(*filter));
 	if (filter == NULL)
 	{
-		snprintf(ctx->error, ctx->error_size, "regex filter: malloc failed");
+		snprintf(ctx->error, ctx->error_size, "regex filter: alloc failed");
 		return NULL;
 	}
 	
@@ -327,7 +738,8 @@ filter_regex_parse(filter_parse_ctx_t* ctx, json_object_t* obj)
 		return NULL;
 	}
 
-	filter->extra = pcre_study(filter->code, 0, &errstr);
+	filter->extra = pcre_ext_study(filter->code, &errstr);
+	filter->pattern = pattern_dec.data;
 	if (errstr != NULL) 
 	{
 		snprintf(ctx->error, ctx->error_size, "regex filter: study failed: %s", errstr);
@@ -337,174 +749,1311 @@ filter_regex_parse(filter_parse_ctx_t* ctx, json_object_t* obj)
 	return &filter->base;
 }
 
-/// not filter
+/// field filter
+/*
+	Compares the value of a key path (e.g. a.b) in a json block (e.g. a json log line) to a
+	reference value. The block is scanned lazily (see json_get_path_raw_value), only the keys
+	along the path are compared, and the scan stops once the path is found. Strings that contain
+	escape sequences are decoded to a per thread pool, that is reset on each evaluation.
+	Values of a different type than the reference value are not equal to it.
+*/
+#define FIELD_MAX_NUMBER_LEN (64)
+#define FIELD_THREAD_POOL_BLOCK_SIZE (4096)
+
+#define filter_field_type_class(type) ((type) == JSON_FRAC ? JSON_INT : (type))
+
+enum {
+	FIELD_OP_EQUALS,
+	FIELD_OP_NOT_EQUALS,
+	FIELD_OP_LESS_THAN,
+	FIELD_OP_LESS_EQUAL,
+	FIELD_OP_GREATER_THAN,
+	FIELD_OP_GREATER_EQUAL,
+	FIELD_OP_EXISTS,
+};
+
 typedef struct
 {
 	filter_base_t base;
-	filter_base_t* filter;
-} filter_not_t;
+	str_t* path;
+	size_t path_count;
+	str_t path_text;
+	int op;
+	int type;					// the type of the reference value
+	str_t str;
+	long double num;
+	bool_t boolean;
+} filter_field_t;
 
-static bool_t 
-filter_not_eval(void* obj, str_t* block)
-{
-	filter_base_t* filter = ((filter_not_t*)obj)->filter;
-	
-	return !filter->eval(filter, block);
-}
+static str_t filter_field_ops[] = {		// indexed by FIELD_OP_XXX
+	str_init("="),
+	str_init("!="),
+	str_init("<"),
+	str_init("<="),
+	str_init(">"),
+	str_init(">="),
+	str_init("exists"),
+};
 
-static filter_base_t*
-filter_not_parse(filter_parse_ctx_t* ctx, json_object_t* obj)
+static __thread pool_t* filter_thread_pool = NULL;
+
+static pool_t*
+filter_get_thread_pool()
 {
-	filter_not_t* filter;
-	json_value_t* child;
-	
-	child = filter_get_json_object_value(obj, "filter", sizeof("filter") - 1, JSON_OBJECT);
-	if (child == NULL)
+	// Note: the allocations of the previous evaluation are released
+	if (filter_thread_pool == NULL)
 	{
-		snprintf(ctx->error, ctx->error_size, "not filter: missing filter field");
-		return NULL;
+		filter_thread_pool = pool_create(FIELD_THREAD_POOL_BLOCK_SIZE);
 	}
-
-	filter = malloc(sizeof(*filter));
-	if (filter == NULL)
+	else
 	{
-		snprintf(ctx->error, ctx->error_size, "not filter: malloc failed");
-		return NULL;
+		pool_reset(filter_thread_pool);
 	}
 
-	filter->filter = filter_parse_object(ctx, &child->v.obj);
-	if (filter->filter == NULL)
+	return filter_thread_pool;
+}
+
+static bool_t
+filter_field_parse_number(str_t* raw, long double* result)
+{
+	char buf[FIELD_MAX_NUMBER_LEN];
+	char* end;
+
+	if (raw->len >= sizeof(buf))
 	{
-		return NULL;
+		return FALSE;
 	}
-	
-	filter->base.eval = &filter_not_eval;
-	return &filter->base;
+
+	memcpy(buf, raw->data, raw->len);
+	buf[raw->len] = '\0';
+
+	*result = strtold(buf, &end);
+	return end == buf + raw->len;
 }
 
-/// and/or filters
-typedef struct
+static int
+filter_field_compare_str(str_t* str1, str_t* str2)
 {
-	filter_base_t base;
-	filter_base_t** filters;
-} filter_and_or_t;
+	int compare_result;
 
-static filter_base_t*
-filter_and_or_parse(filter_parse_ctx_t* ctx, json_object_t* obj, filter_eval_func_t eval)
+	compare_result = memcmp(str1->data, str2->data, min(str1->len, str2->len));
+	if (compare_result != 0)
+	{
+		return compare_result;
+	}
+
+	return str1->len < str2->len ? -1 : str1->len > str2->len ? 1 : 0;
+}
+
+static bool_t
+filter_field_eval(void* obj, str_t* block)
 {
-	filter_and_or_t* filter;
-	filter_base_t* cur_filter;
-	filter_base_t** filters;
-	json_value_t* arr;
-	json_object_t* cur;
-	json_object_t* end;
-	json_array_t* items;
-	
-	arr = filter_get_json_object_value(obj, "filters", sizeof("filters") - 1, JSON_ARRAY);
-	if (arr == NULL)
+	filter_field_t* filter = obj;
+	json_raw_value_t value;
+	long double num;
+	pool_t* pool;
+	str_t decoded;
+	int compare_result;
+
+	if (json_get_path_raw_value(block, filter->path, filter->path_count, &value) != JSON_OK)
 	{
-		snprintf(ctx->error, ctx->error_size, "and/or filter: missing filters field");
-		return NULL;
+		return FALSE;
 	}
-	
-	if (arr->v.arr.type != JSON_OBJECT)
+
+	if (filter->op == FIELD_OP_EXISTS)
 	{
-		snprintf(ctx->error, ctx->error_size, "and/or filter: filters array must contain objects");
-		return NULL;
+		return TRUE;
 	}
-	
-	items = &arr->v.arr.items;
-	filter = malloc(sizeof(*filter) + sizeof(filter->filters[0]) * (items->nelts + 1));
-	if (filter == NULL)
+
+	if (filter_field_type_class(value.type) != filter_field_type_class(filter->type))
 	{
-		snprintf(ctx->error, ctx->error_size, "and/or filter: malloc failed");
-		return NULL;
+		return filter->op == FIELD_OP_NOT_EQUALS;
 	}
-		
-	filter->filters = filters = (void*)(filter + 1);
-	
-	cur = (json_object_t*)items->elts;
-	end = cur + items->nelts;
-	
-	for (; cur < end; cur++)
+
+	switch (filter->type)
 	{
-		cur_filter = filter_parse_object(ctx, cur);
+	case JSON_STRING:
+		if (memchr(value.raw.data, '\\', value.raw.len) != NULL)
+		{
+			// Note: the decoded string is never longer than the escaped string
+			pool = filter_get_thread_pool();
+			if (pool == NULL)
+			{
+				return FALSE;
+			}
+
+			decoded.data = pool_alloc(pool, value.raw.len);
+			decoded.len = 0;
+			if (decoded.data == NULL ||
+				json_decode_string(&decoded, &value.raw) != JSON_OK)
+			{
+				return FALSE;
+			}
+			value.raw = decoded;
+		}
+
+		compare_result = filter_field_compare_str(&value.raw, &filter->str);
+		break;
+
+	case JSON_INT:
+	case JSON_FRAC:
+		if (!filter_field_parse_number(&value.raw, &num))
+		{
+			return FALSE;
+		}
+
+		compare_result = num < filter->num ? -1 : num > filter->num ? 1 : 0;
+		break;
+
+	case JSON_BOOL:
+		compare_result = (value.raw.data[0] == 't') - filter->boolean;
+		break;
+
+	default:		// JSON_NULL
+		compare_result = 0;
+		break;
+	}
+
+	switch (filter->op)
+	{
+	case FIELD_OP_EQUALS:
+		return compare_result == 0;
+
+	case FIELD_OP_NOT_EQUALS:
+		return compare_result != 0;
+
+	case FIELD_OP_LESS_THAN:
+		return compare_result < 0;
+
+	case FIELD_OP_LESS_EQUAL:
+		return compare_result <= 0;
+
+	case FIELD_OP_GREATER_THAN:
+		return compare_result > 0;
+
+	default:		// FIELD_OP_GREATER_EQUAL
+		return compare_result >= 0;
+	}
+}
+
+static json_value_t*
+filter_field_get_value(json_object_t* obj)
+{
+	static int types[] = { JSON_STRING, JSON_INT, JSON_FRAC, JSON_BOOL, JSON_NULL };
+	json_value_t* value;
+	size_t i;
+
+	for (i = 0; i < array_entries(types); i++)
+	{
+		value = filter_get_json_object_value(obj, "value", sizeof("value") - 1, types[i]);
+		if (value != NULL)
+		{
+			return value;
+		}
+	}
+
+	return NULL;
+}
+
+static filter_base_t*
+filter_field_parse(filter_parse_ctx_t* ctx, json_object_t* obj)
+{
+	filter_field_t* filter;
+	json_value_t* value;
+	str_t path_text;
+	str_t* path;
+	str_t* op;
+	size_t value_len;
+	size_t count;
+	char* cur;
+	char* end;
+	char* key_end;
+	int op_index;
+
+	path = filter_get_json_object_string_value(obj, "path", sizeof("path") - 1);
+	if (path == NULL || path->len == 0)
+	{
+		snprintf(ctx->error, ctx->error_size, "field filter: missing path field");
+		return NULL;
+	}
+
+	op = filter_get_json_object_string_value(obj, "op", sizeof("op") - 1);
+	op_index = FIELD_OP_EQUALS;
+	if (op != NULL)
+	{
+		for (op_index = 0; ; op_index++)
+		{
+			if (op_index >= (int)array_entries(filter_field_ops))
+			{
+				snprintf(ctx->error, ctx->error_size, "field filter: invalid op \"%.*s\"", str_f(*op));
+				return NULL;
+			}
+
+			if (op->len == filter_field_ops[op_index].len &&
+				memcmp(op->data, filter_field_ops[op_index].data, op->len) == 0)
+			{
+				break;
+			}
+		}
+	}
+
+	value = NULL;
+	value_len = 0;
+	if (op_index != FIELD_OP_EXISTS)
+	{
+		value = filter_field_get_value(obj);
+		if (value == NULL)
+		{
+			snprintf(ctx->error, ctx->error_size, "field filter: missing value field");
+			return NULL;
+		}
+
+		if ((value->type == JSON_BOOL || value->type == JSON_NULL) &&
+			op_index != FIELD_OP_EQUALS && op_index != FIELD_OP_NOT_EQUALS)
+		{
+			snprintf(ctx->error, ctx->error_size, "field filter: bool / null values support only = and !=");
+			return NULL;
+		}
+
+		if (value->type == JSON_STRING)
+		{
+			value_len = value->v.str.len;
+		}
+	}
+
+	// decode the path before counting its keys, an escaped dot (\u002e) is also a key separator
+	path_text.data = pool_alloc(ctx->pool, path->len);
+	if (path_text.data == NULL)
+	{
+		snprintf(ctx->error, ctx->error_size, "field filter: alloc failed");
+		return NULL;
+	}
+	path_text.len = 0;
+
+	if (json_decode_string(&path_text, path) != JSON_OK)
+	{
+		snprintf(ctx->error, ctx->error_size, "field filter: failed to decode path");
+		return NULL;
+	}
+
+	// count the keys of the path
+	count = 1;
+	for (cur = path_text.data, end = cur + path_text.len; cur < end; cur++)
+	{
+		if (*cur == '.')
+		{
+			count++;
+		}
+	}
+
+	filter = pool_alloc(ctx->pool, sizeof(*filter) + sizeof(filter->path[0]) * count + path_text.len + value_len);
+	if (filter == NULL)
+	{
+		snprintf(ctx->error, ctx->error_size, "field filter: alloc failed");
+		return NULL;
+	}
+
+	filter->path = (void*)(filter + 1);
+	filter->path_text.data = (void*)(filter->path + count);
+	filter->path_text.len = path_text.len;
+	memcpy(filter->path_text.data, path_text.data, path_text.len);
+	filter->str.data = filter->path_text.data + path_text.len;
+	filter->str.len = 0;
+
+	// split the path
+	filter->path_count = 0;
+	cur = filter->path_text.data;
+	end = cur + filter->path_text.len;
+	for (;;)
+	{
+		key_end = memchr(cur, '.', end - cur);
+		if (key_end == NULL)
+		{
+			key_end = end;
+		}
+
+		if (key_end <= cur)
+		{
+			snprintf(ctx->error, ctx->error_size, "field filter: empty key in path \"%.*s\"", str_f(filter->path_text));
+			return NULL;
+		}
+
+		filter->path[filter->path_count].data = cur;
+		filter->path[filter->path_count].len = key_end - cur;
+		filter->path_count++;
+
+		if (key_end >= end)
+		{
+			break;
+		}
+		cur = key_end + 1;
+	}
+
+	filter->op = op_index;
+	filter->type = value != NULL ? value->type : JSON_NULL;
+
+	if (value != NULL)
+	{
+		switch (value->type)
+		{
+		case JSON_STRING:
+			if (json_decode_string(&filter->str, &value->v.str) != JSON_OK)
+			{
+				snprintf(ctx->error, ctx->error_size, "field filter: failed to decode value");
+				return NULL;
+			}
+			break;
+
+		case JSON_INT:
+		case JSON_FRAC:
+			filter->num = (long double)value->v.num.num / value->v.num.denom;
+			break;
+
+		case JSON_BOOL:
+			filter->boolean = value->v.boolean;
+			break;
+		}
+	}
+
+	filter->base.eval = &filter_field_eval;
+	return &filter->base;
+}
+
+void
+filter_thread_cleanup()
+{
+	pool_destroy(filter_thread_pool);
+	filter_thread_pool = NULL;
+}
+
+/// not filter
+typedef struct
+{
+	filter_base_t base;
+	filter_base_t* filter;
+} filter_not_t;
+
+static bool_t 
+filter_not_eval(void* obj, str_t* block)
+{
+	filter_base_t* filter = ((filter_not_t*)obj)->filter;
+	
+	return !filter->eval(filter, block);
+}
+
+static filter_base_t*
+filter_not_parse(filter_parse_ctx_t* ctx, json_object_t* obj)
+{
+	filter_not_t* filter;
+	json_value_t* child;
+	
+	child = filter_get_json_object_value(obj, "filter", sizeof("filter") - 1, JSON_OBJECT);
+	if (child == NULL)
+	{
+		snprintf(ctx->error, ctx->error_size, "not filter: missing filter field");
+		return NULL;
+	}
+
+	filter = pool_alloc(ctx->pool, sizeof(*filter));
+	if (filter == NULL)
+	{
+		snprintf(ctx->error, ctx->error_size, "not filter: alloc failed");
+		return NULL;
+	}
+
+	filter->filter = filter_parse_object(ctx, &child->v.obj);
+	if (filter->filter == NULL)
+	{
+		return NULL;
+	}
+	
+	filter->base.eval = &filter_not_eval;
+	return &filter->base;
+}
+
+/// and/or filters
+typedef struct
+{
+	filter_base_t base;
+	filter_base_t** filters;
+} filter_and_or_t;
+
+static filter_base_t*
+filter_and_or_parse(filter_parse_ctx_t* ctx, json_object_t* obj, filter_eval_func_t eval)
+{
+	filter_and_or_t* filter;
+	filter_base_t* cur_filter;
+	filter_base_t** filters;
+	json_value_t* arr;
+	json_object_t* cur;
+	json_object_t* end;
+	json_array_t* items;
+	
+	arr = filter_get_json_object_value(obj, "filters", sizeof("filters") - 1, JSON_ARRAY);
+	if (arr == NULL)
+	{
+		snprintf(ctx->error, ctx->error_size, "and/or filter: missing filters field");
+		return NULL;
+	}
+	
+	if (arr->v.arr.type != JSON_OBJECT)
+	{
+		snprintf(ctx->error, ctx->error_size, "and/or filter: filters array must contain objects");
+		return NULL;
+	}
+	
+	items = &arr->v.arr.items;
+	filter = pool_alloc(ctx->pool, sizeof(*filter) + sizeof(filter->filters[0]) * (items->nelts + 1));
+	if (filter == NULL)
+	{
+		snprintf(ctx->error, ctx->error_size, "and/or filter: alloc failed");
+		return NULL;
+	}
+		
+	filter->filters = filters = (void*)(filter + 1);
+	
+	cur = (json_object_t*)items->elts;
+	end = cur + items->nelts;
+	
+	for (; cur < end; cur++)
+	{
+		cur_filter = filter_parse_object(ctx, cur);
 		if (cur_filter == NULL)
 		{
 			return NULL;
 		}
-		
-		*filters++ = cur_filter;
+		
+		*filters++ = cur_filter;
+	}
+	
+	*filters = NULL;
+	filter->base.eval = eval;	
+	return &filter->base;
+}
+
+static bool_t 
+filter_and_eval(void* obj, str_t* block)
+{
+	filter_base_t** filters = ((filter_and_or_t*)obj)->filters;
+	filter_base_t* filter;
+	
+	for (;;)
+	{
+		filter = *filters;
+		if (filter == NULL)
+		{
+			break;
+		}
+		
+		if (!filter->eval(filter, block))
+		{
+			return FALSE;
+		}
+		
+		filters++;
+	}
+	
+	return TRUE;
+}
+
+static bool_t 
+filter_or_eval(void* obj, str_t* block)
+{
+	filter_base_t** filters = ((filter_and_or_t*)obj)->filters;
+	filter_base_t* filter;
+	
+	for (;;)
+	{
+		filter = *filters;
+		if (filter == NULL)
+		{
+			break;
+		}
+		
+		if (filter->eval(filter, block))
+		{
+			return TRUE;
+		}
+		
+		filters++;
+	}
+	
+	return FALSE;
+}
+
+static filter_base_t*
+filter_and_parse(filter_parse_ctx_t* ctx, json_object_t* obj)
+{
+	return filter_and_or_parse(ctx, obj, filter_and_eval);
+}
+
+static filter_base_t*
+filter_or_parse(filter_parse_ctx_t* ctx, json_object_t* obj)
+{
+	return filter_and_or_parse(ctx, obj, filter_or_eval);
+}
+
+/// optimizer
+/*
+	The filter tree is optimized after parsing, in two passes -
+	1. normalize - double negations are removed, nested and/or filters of the same type are
+		flattened, and a not of an and/or is pushed inward (De Morgan) when the result can be
+		flattened into the parent, e.g. and(a, not(or(b, c))) -> and(a, not(b), not(c))
+	2. order - the match filters of each or are merged (see multi match filter), and the
+		children of each and/or are sorted by their estimated cost, so that the cheap filters
+		are evaluated first
+	The filters have no side effects, so the order of evaluation does not change the result.
+*/
+enum {
+	FILTER_COST_TRUE = 0,
+	FILTER_COST_MATCH = 1,
+	FILTER_COST_MATCH_CASE = 2,
+	FILTER_COST_MULTI_MATCH = 4,
+	FILTER_COST_FIELD = 8,
+	FILTER_COST_REGEX = 16,
+};
+
+#define filter_is_and_or(filter)		\
+	((filter)->eval == &filter_and_eval || (filter)->eval == &filter_or_eval)
+
+static filter_base_t*
+filter_negate(filter_parse_ctx_t* ctx, filter_base_t* filter)
+{
+	filter_not_t* result;
+
+	if (filter->eval == &filter_not_eval)
+	{
+		return ((filter_not_t*)filter)->filter;
+	}
+
+	result = pool_alloc(ctx->pool, sizeof(*result));
+	if (result == NULL)
+	{
+		snprintf(ctx->error, ctx->error_size, "not filter: alloc failed");
+		return NULL;
+	}
+
+	result->base.eval = &filter_not_eval;
+	result->filter = filter;
+	return &result->base;
+}
+
+static filter_and_or_t*
+filter_get_dual_child(filter_and_or_t* filter, filter_base_t* child)
+{
+	filter_base_t* inner;
+
+	// returns the and/or that child negates, if it can be flattened into filter by De Morgan
+	if (child->eval != &filter_not_eval)
+	{
+		return NULL;
+	}
+
+	inner = ((filter_not_t*)child)->filter;
+	if (!filter_is_and_or(inner) || inner->eval == filter->base.eval)
+	{
+		return NULL;
+	}
+
+	return (filter_and_or_t*)inner;
+}
+
+static filter_base_t*
+filter_normalize(filter_parse_ctx_t* ctx, filter_base_t* filter)
+{
+	filter_and_or_t* and_or;
+	filter_and_or_t* dual;
+	filter_base_t** filters;
+	filter_base_t** dest;
+	filter_base_t** cur;
+	filter_base_t** src;
+	filter_not_t* not;
+	size_t count;
+
+	if (filter->eval == &filter_not_eval)
+	{
+		not = (filter_not_t*)filter;
+		if (not->filter->eval == &filter_not_eval)
+		{
+			return filter_normalize(ctx, ((filter_not_t*)not->filter)->filter);
+		}
+
+		not->filter = filter_normalize(ctx, not->filter);
+		return not->filter != NULL ? filter : NULL;
+	}
+
+	if (!filter_is_and_or(filter))
+	{
+		return filter;
+	}
+
+	and_or = (filter_and_or_t*)filter;
+
+	// normalize the children and count the flattened children
+	count = 0;
+	for (cur = and_or->filters; *cur != NULL; cur++)
+	{
+		*cur = filter_normalize(ctx, *cur);
+		if (*cur == NULL)
+		{
+			return NULL;
+		}
+
+		if ((*cur)->eval == filter->eval)
+		{
+			src = ((filter_and_or_t*)*cur)->filters;
+		}
+		else if ((dual = filter_get_dual_child(and_or, *cur)) != NULL)
+		{
+			src = dual->filters;
+		}
+		else
+		{
+			count++;
+			continue;
+		}
+
+		for (; *src != NULL; src++)
+		{
+			count++;
+		}
+	}
+
+	filters = pool_alloc(ctx->pool, sizeof(filters[0]) * (count + 1));
+	if (filters == NULL)
+	{
+		snprintf(ctx->error, ctx->error_size, "and/or filter: alloc failed");
+		return NULL;
+	}
+
+	// Note: normalized children do not contain children that can be flattened, one level is enough
+	dest = filters;
+	for (cur = and_or->filters; *cur != NULL; cur++)
+	{
+		if ((*cur)->eval == filter->eval)
+		{
+			for (src = ((filter_and_or_t*)*cur)->filters; *src != NULL; src++)
+			{
+				*dest++ = *src;
+			}
+		}
+		else if ((dual = filter_get_dual_child(and_or, *cur)) != NULL)
+		{
+			for (src = dual->filters; *src != NULL; src++)
+			{
+				*dest = filter_negate(ctx, *src);
+				if (*dest == NULL)
+				{
+					return NULL;
+				}
+				dest++;
+			}
+		}
+		else
+		{
+			*dest++ = *cur;
+		}
+	}
+
+	*dest = NULL;
+	and_or->filters = filters;
+	return filter;
+}
+
+static bool_t
+filter_or_group_matches(filter_parse_ctx_t* ctx, filter_and_or_t* filter)
+{
+	filter_multi_match_needle_t* needles;
+	filter_base_t** first = NULL;
+	filter_base_t** dest;
+	filter_base_t** cur;
+	filter_match_t* match;
+	size_t count;
+
+	count = 0;
+	for (cur = filter->filters; *cur != NULL; cur++)
+	{
+		if ((*cur)->eval == &filter_match_eval || (*cur)->eval == &filter_match_eval_case)
+		{
+			count++;
+		}
+	}
+
+	if (count < MULTI_MATCH_MIN_NEEDLES)
+	{
+		return TRUE;
+	}
+
+	needles = pool_alloc(ctx->pool, sizeof(needles[0]) * count);
+	if (needles == NULL)
+	{
+		snprintf(ctx->error, ctx->error_size, "or filter: alloc failed");
+		return FALSE;
+	}
+
+	// replace the match filters with a single multi match filter, in the position of the first one
+	count = 0;
+	for (cur = dest = filter->filters; *cur != NULL; cur++)
+	{
+		if ((*cur)->eval != &filter_match_eval && (*cur)->eval != &filter_match_eval_case)
+		{
+			*dest++ = *cur;
+			continue;
+		}
+
+		match = (filter_match_t*)*cur;
+		needles[count].text = match->text;
+		needles[count].caseless = match->base.eval == &filter_match_eval_case;
+		count++;
+
+		if (first == NULL)
+		{
+			first = dest++;
+		}
+	}
+
+	*dest = NULL;
+
+	*first = filter_multi_match_create(ctx, needles, count);
+	return *first != NULL;
+}
+
+static filter_base_t*
+filter_order(filter_parse_ctx_t* ctx, filter_base_t* filter)
+{
+	filter_and_or_t* and_or;
+	filter_base_t** filters;
+	filter_base_t* child;
+	filter_not_t* not;
+	size_t i;
+	size_t j;
+
+	if (filter->eval == &filter_not_eval)
+	{
+		not = (filter_not_t*)filter;
+		not->filter = filter_order(ctx, not->filter);
+		if (not->filter == NULL)
+		{
+			return NULL;
+		}
+
+		filter->cost = not->filter->cost;
+		return filter;
+	}
+
+	if (!filter_is_and_or(filter))
+	{
+		if (filter->eval == &filter_eval_true)
+		{
+			filter->cost = FILTER_COST_TRUE;
+		}
+		else if (filter->eval == &filter_match_eval)
+		{
+			filter->cost = FILTER_COST_MATCH;
+		}
+		else if (filter->eval == &filter_match_eval_case)
+		{
+			filter->cost = FILTER_COST_MATCH_CASE;
+		}
+		else if (filter->eval == &filter_multi_match_eval)
+		{
+			filter->cost = FILTER_COST_MULTI_MATCH;
+		}
+		else if (filter->eval == &filter_field_eval)
+		{
+			filter->cost = FILTER_COST_FIELD;
+		}
+		else
+		{
+			filter->cost = FILTER_COST_REGEX;
+		}
+		return filter;
+	}
+
+	and_or = (filter_and_or_t*)filter;
+	filters = and_or->filters;
+
+	if (filter->eval == &filter_or_eval &&
+		!filter_or_group_matches(ctx, and_or))
+	{
+		return NULL;
+	}
+
+	// order the children and sort them by cost, keeping the original order on ties
+	filter->cost = 0;
+	for (i = 0; filters[i] != NULL; i++)
+	{
+		child = filter_order(ctx, filters[i]);
+		if (child == NULL)
+		{
+			return NULL;
+		}
+
+		filter->cost += child->cost;
+
+		for (j = i; j > 0 && filters[j - 1]->cost > child->cost; j--)
+		{
+			filters[j] = filters[j - 1];
+		}
+		filters[j] = child;
 	}
-	
-	*filters = NULL;
-	filter->base.eval = eval;	
-	return &filter->base;
+
+	if (i == 1)
+	{
+		return filters[0];		// no need for the and/or
+	}
+
+	return filter;
 }
 
-static bool_t 
-filter_and_eval(void* obj, str_t* block)
+static filter_base_t*
+filter_optimize(filter_parse_ctx_t* ctx, filter_base_t* filter)
 {
-	filter_base_t** filters = ((filter_and_or_t*)obj)->filters;
-	filter_base_t* filter;
-	
-	for (;;)
+	filter = filter_normalize(ctx, filter);
+	if (filter == NULL)
 	{
-		filter = *filters;
-		if (filter == NULL)
+		return NULL;
+	}
+
+	return filter_order(ctx, filter);
+}
+
+/// stats
+/*
+	When stats are enabled, the eval function of each filter is replaced with a function that
+	counts the evaluations / matches and the cycles spent in the filter (including its children).
+	Note: must be called after filter_optimize, since the optimizer identifies the filters by their
+	eval functions.
+*/
+#define FILTER_STATS_MAX_TEXTS (5)		// the number of texts printed for a multi match filter
+
+static bool_t
+filter_stats_eval(void* obj, str_t* block)
+{
+	filter_base_t* filter = obj;
+	uint64_t start;
+	bool_t result;
+
+	start = get_cycles();
+	result = filter->stats_eval(obj, block);
+	eval_stats_update(&filter->stats, result, start);
+	return result;
+}
+
+static size_t
+filter_get_children(filter_base_t* filter, filter_eval_func_t eval, filter_base_t*** children)
+{
+	filter_base_t** cur;
+
+	if (eval == &filter_not_eval)
+	{
+		*children = &((filter_not_t*)filter)->filter;
+		return 1;
+	}
+
+	if (eval == &filter_and_eval || eval == &filter_or_eval)
+	{
+		*children = ((filter_and_or_t*)filter)->filters;
+		for (cur = *children; *cur != NULL; cur++);
+		return cur - *children;
+	}
+
+	return 0;
+}
+
+void
+filter_stats_enable(filter_base_t* filter)
+{
+	filter_base_t** children;
+	size_t count;
+	size_t i;
+
+	filter->stats_eval = filter->eval;
+	filter->eval = &filter_stats_eval;
+	memset(&filter->stats, 0, sizeof(filter->stats));
+
+	count = filter_get_children(filter, filter->stats_eval, &children);
+	for (i = 0; i < count; i++)
+	{
+		filter_stats_enable(children[i]);
+	}
+}
+
+static void
+filter_stats_print_name(filter_base_t* filter, FILE* fp)
+{
+	filter_eval_func_t eval = filter->stats_eval;
+	filter_multi_match_t* multi;
+	filter_field_t* field;
+	filter_match_t* match;
+	size_t i;
+
+	if (eval == &filter_not_eval)
+	{
+		fprintf(fp, "not");
+	}
+	else if (eval == &filter_and_eval)
+	{
+		fprintf(fp, "and");
+	}
+	else if (eval == &filter_or_eval)
+	{
+		fprintf(fp, "or");
+	}
+	else if (eval == &filter_regex_eval)
+	{
+		fprintf(fp, "regex \"%s\"", ((filter_regex_t*)filter)->pattern);
+	}
+	else if (eval == &filter_multi_match_eval)
+	{
+		multi = (filter_multi_match_t*)filter;
+		fprintf(fp, "multi match");
+		for (i = 0; i < multi->needle_count && i < FILTER_STATS_MAX_TEXTS; i++)
 		{
-			break;
+			fprintf(fp, "%s\"%.*s\"", i > 0 ? " | " : " ", str_f(multi->needles[i].text));
 		}
-		
-		if (!filter->eval(filter, block))
+		if (multi->needle_count > FILTER_STATS_MAX_TEXTS)
 		{
-			return FALSE;
+			fprintf(fp, " | ... (%zu texts)", multi->needle_count);
 		}
-		
-		filters++;
 	}
-	
-	return TRUE;
+	else if (eval == &filter_field_eval)
+	{
+		field = (filter_field_t*)filter;
+		fprintf(fp, "field \"%.*s\" %.*s", str_f(field->path_text), str_f(filter_field_ops[field->op]));
+		if (field->op == FIELD_OP_EXISTS)
+		{
+			return;
+		}
+
+		switch (field->type)
+		{
+		case JSON_STRING:
+			fprintf(fp, " \"%.*s\"", str_f(field->str));
+			break;
+
+		case JSON_INT:
+		case JSON_FRAC:
+			fprintf(fp, " %Lg", field->num);
+			break;
+
+		case JSON_BOOL:
+			fprintf(fp, " %s", field->boolean ? "true" : "false");
+			break;
+
+		default:
+			fprintf(fp, " null");
+			break;
+		}
+	}
+	else if (eval == &filter_match_eval || eval == &filter_match_eval_case)
+	{
+		match = (filter_match_t*)filter;
+		fprintf(fp, "match \"%.*s\"%s", str_f(match->text), eval == &filter_match_eval_case ? " (ignorecase)" : "");
+	}
+	else
+	{
+		fprintf(fp, "true");
+	}
 }
 
-static bool_t 
-filter_or_eval(void* obj, str_t* block)
+static void
+filter_stats_print_node(filter_base_t* filter, int depth, FILE* fp)
+{
+	filter_base_t** children;
+	size_t count;
+	size_t i;
+
+	fprintf(fp, "  %*s", depth * 2, "");
+	filter_stats_print_name(filter, fp);
+	fprintf(fp, ": evals=%" PRIu64 " matches=%" PRIu64 " cycles=%" PRIu64 "\n",
+		filter->stats.evals, filter->stats.matches, filter->stats.cycles);
+
+	count = filter_get_children(filter, filter->stats_eval, &children);
+	for (i = 0; i < count; i++)
+	{
+		filter_stats_print_node(children[i], depth + 1, fp);
+	}
+}
+
+void
+filter_stats_print(filter_base_t* filter, FILE* fp)
+{
+	fprintf(fp, "filter (cycles include the children):\n");
+	filter_stats_print_node(filter, 0, fp);
+}
+
+/// stream
+/*
+	Blocks that are larger than the block buffer are evaluated in chunks. Each leaf filter
+	(match / multi match / regex) is evaluated on the chunks until it matches, the chunks
+	overlap by the length of the longest text - 1, so that texts that cross a chunk boundary
+	are found. The and / or / not filters are evaluated in three valued logic, a leaf that
+	did not match yet is unknown, so the result is usually known before the end of the block.
+	Field filters are evaluated on the first chunk only, the object starts at the first { of
+	the block. Regex matches longer than FILTER_STREAM_REGEX_OVERLAP that cross a chunk
+	boundary are not found. Regex leaves are evaluated with PCRE_NOTBOL on all chunks but the
+	first, and with PCRE_NOTEOL on all chunks but the last, so that ^ / $ match only at the
+	start / end of the block, as when the block is evaluated as a whole.
+*/
+#define FILTER_STREAM_REGEX_OVERLAP (4096)
+
+#define filter_get_eval(filter)		\
+	((filter)->eval == &filter_stats_eval ? (filter)->stats_eval : (filter)->eval)
+
+struct filter_stream_s
 {
-	filter_base_t** filters = ((filter_and_or_t*)obj)->filters;
 	filter_base_t* filter;
-	
-	for (;;)
+	filter_base_t** leaves;		// indexed by stream_index
+	u_char* results;			// leaf -> FILTER_STREAM_XXX
+	size_t leaf_count;
+	size_t overlap;
+};
+
+static size_t
+filter_stream_index(filter_base_t* filter, size_t leaf_count)
+{
+	filter_base_t** children;
+	size_t count;
+	size_t i;
+
+	// Note: called by filter_parse, before the stats are enabled
+	count = filter_get_children(filter, filter->eval, &children);
+	if (count <= 0)
 	{
-		filter = *filters;
-		if (filter == NULL)
+		filter->stream_index = leaf_count;
+		return leaf_count + 1;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		leaf_count = filter_stream_index(children[i], leaf_count);
+	}
+
+	return leaf_count;
+}
+
+static void
+filter_stream_add_leaves(filter_stream_t* stream, filter_base_t* filter)
+{
+	filter_multi_match_t* multi;
+	filter_base_t** children;
+	filter_eval_func_t eval;
+	size_t count;
+	size_t i;
+
+	eval = filter_get_eval(filter);
+
+	count = filter_get_children(filter, eval, &children);
+	if (count > 0)
+	{
+		for (i = 0; i < count; i++)
 		{
-			break;
+			filter_stream_add_leaves(stream, children[i]);
 		}
-		
-		if (filter->eval(filter, block))
+		return;
+	}
+
+	stream->leaves[filter->stream_index] = filter;
+
+	if (eval == &filter_regex_eval)
+	{
+		stream->overlap = max(stream->overlap, FILTER_STREAM_REGEX_OVERLAP);
+	}
+	else if (eval == &filter_multi_match_eval)
+	{
+		multi = (filter_multi_match_t*)filter;
+		for (i = 0; i < multi->needle_count; i++)
 		{
-			return TRUE;
+			stream->overlap = max(stream->overlap, multi->needles[i].text.len - 1);
 		}
-		
-		filters++;
 	}
-	
-	return FALSE;
+	else if (eval == &filter_match_eval || eval == &filter_match_eval_case)
+	{
+		stream->overlap = max(stream->overlap, ((filter_match_t*)filter)->text.len - 1);
+	}
 }
 
-static filter_base_t*
-filter_and_parse(filter_parse_ctx_t* ctx, json_object_t* obj)
+filter_stream_t*
+filter_stream_create(filter_base_t* filter)
 {
-	return filter_and_or_parse(ctx, obj, filter_and_eval);
+	filter_stream_t* stream;
+	size_t leaf_count;
+
+	leaf_count = filter->stream_leaf_count;
+
+	stream = malloc(sizeof(*stream) + (sizeof(stream->leaves[0]) + sizeof(stream->results[0])) * leaf_count);
+	if (stream == NULL)
+	{
+		return NULL;
+	}
+
+	stream->filter = filter;
+	stream->leaves = (void*)(stream + 1);
+	stream->results = (void*)(stream->leaves + leaf_count);
+	stream->leaf_count = leaf_count;
+	stream->overlap = 0;
+
+	filter_stream_add_leaves(stream, filter);
+
+	return stream;
 }
 
-static filter_base_t*
-filter_or_parse(filter_parse_ctx_t* ctx, json_object_t* obj)
+size_t
+filter_stream_overlap(filter_stream_t* stream)
 {
-	return filter_and_or_parse(ctx, obj, filter_or_eval);
+	return stream->overlap;
+}
+
+static bool_t
+filter_stream_eval_leaf(filter_base_t* leaf, str_t* chunk, int options)
+{
+	uint64_t start;
+	bool_t result;
+
+	if (filter_get_eval(leaf) != &filter_regex_eval)
+	{
+		return leaf->eval(leaf, chunk);
+	}
+
+	if (leaf->eval != &filter_stats_eval)
+	{
+		return filter_regex_exec((filter_regex_t*)leaf, chunk, options);
+	}
+
+	start = get_cycles();
+	result = filter_regex_exec((filter_regex_t*)leaf, chunk, options);
+	eval_stats_update(&leaf->stats, result, start);
+	return result;
+}
+
+static void
+filter_stream_eval_leaves(filter_stream_t* stream, char* data, size_t len, int options)
+{
+	filter_base_t* leaf;
+	str_t str;
+	size_t i;
+
+	str.data = data;
+	str.len = len;
+
+	for (i = 0; i < stream->leaf_count; i++)
+	{
+		leaf = stream->leaves[i];
+		if (stream->results[i] == FILTER_STREAM_UNKNOWN &&
+			filter_stream_eval_leaf(leaf, &str, options))
+		{
+			stream->results[i] = FILTER_STREAM_TRUE;
+		}
+	}
+}
+
+static int
+filter_stream_result(filter_stream_t* stream, filter_base_t* filter)
+{
+	filter_base_t** children;
+	filter_eval_func_t eval;
+	size_t count;
+	size_t i;
+	int result;
+	int cur;
+
+	eval = filter_get_eval(filter);
+
+	if (eval == &filter_not_eval)
+	{
+		result = filter_stream_result(stream, ((filter_not_t*)filter)->filter);
+		return result == FILTER_STREAM_UNKNOWN ? result : !result;
+	}
+
+	if (eval != &filter_and_eval && eval != &filter_or_eval)
+	{
+		return stream->results[filter->stream_index];
+	}
+
+	// and - false if any child is false, or - true if any child is true
+	result = eval == &filter_and_eval ? FILTER_STREAM_TRUE : FILTER_STREAM_FALSE;
+
+	count = filter_get_children(filter, eval, &children);
+	for (i = 0; i < count; i++)
+	{
+		cur = filter_stream_result(stream, children[i]);
+		if (cur == FILTER_STREAM_UNKNOWN)
+		{
+			result = cur;
+		}
+		else if (cur != (eval == &filter_and_eval ? FILTER_STREAM_TRUE : FILTER_STREAM_FALSE))
+		{
+			return cur;
+		}
+	}
+
+	return result;
+}
+
+int
+filter_stream_start(filter_stream_t* stream, char* data, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < stream->leaf_count; i++)
+	{
+		stream->results[i] = FILTER_STREAM_UNKNOWN;
+	}
+
+	filter_stream_eval_leaves(stream, data, len, PCRE_NOTEOL);
+
+	// field filters are evaluated on the first chunk only
+	for (i = 0; i < stream->leaf_count; i++)
+	{
+		if (stream->results[i] == FILTER_STREAM_UNKNOWN &&
+			filter_get_eval(stream->leaves[i]) == &filter_field_eval)
+		{
+			stream->results[i] = FILTER_STREAM_FALSE;
+		}
+	}
+
+	return filter_stream_result(stream, stream->filter);
+}
+
+int
+filter_stream_write(filter_stream_t* stream, char* data, size_t len)
+{
+	// Note: data starts with the last filter_stream_overlap() bytes of the previous chunk
+	filter_stream_eval_leaves(stream, data, len, PCRE_NOTBOL | PCRE_NOTEOL);
+
+	return filter_stream_result(stream, stream->filter);
+}
+
+bool_t
+filter_stream_end(filter_stream_t* stream, char* data, size_t len)
+{
+	size_t i;
+
+	// Note: data is the last chunk, starting with the overlap, the end of the block is the end of a line
+	filter_stream_eval_leaves(stream, data, len, PCRE_NOTBOL);
+
+	// the leaves that did not match in any of the chunks are false
+	for (i = 0; i < stream->leaf_count; i++)
+	{
+		if (stream->results[i] == FILTER_STREAM_UNKNOWN)
+		{
+			stream->results[i] = FILTER_STREAM_FALSE;
+		}
+	}
+
+	return filter_stream_result(stream, stream->filter) == FILTER_STREAM_TRUE;
+}
+
+void
+filter_stream_free(filter_stream_t* stream)
+{
+	free(stream);
 }
 
 /// base
+#define FILTER_POOL_BLOCK_SIZE (64 * 1024)
+
 typedef struct {
 	str_t name;
 	filter_parse_func_t parse;
@@ -515,6 +2064,7 @@ typedef struct {
 static filter_def_t filter_defs[] = {
 	DEFINE_FILTER(match),
 	DEFINE_FILTER(regex),
+	DEFINE_FILTER(field),
 	DEFINE_FILTER(not),
 	DEFINE_FILTER(and),
 	DEFINE_FILTER(or),
@@ -557,11 +2107,23 @@ filter_parse(char* str, char* error, size_t error_size)
 {
 	filter_parse_ctx_t ctx;
 	filter_base_t* result;
+	pool_t* json_pool;
 	json_value_t json;
 	
 	error[0] = '\0';
 
-	if (json_parse(NULL, str, &json, error, error_size) != JSON_OK)
+	filter_strpos_init();
+
+	// Note: the json is needed only while parsing, the filters copy the strings they use
+	ctx.pool = pool_create(FILTER_POOL_BLOCK_SIZE);
+	json_pool = pool_create(FILTER_POOL_BLOCK_SIZE);
+	if (ctx.pool == NULL || json_pool == NULL)
+	{
+		snprintf(error, error_size, "pool_create failed");
+		goto error;
+	}
+
+	if (json_parse(json_pool, str, &json, error, error_size) != JSON_OK)
 	{
 		goto error;
 	}
@@ -580,11 +2142,22 @@ filter_parse(char* str, char* error, size_t error_size)
 	{
 		goto error;
 	}
-	
+
+	result = filter_optimize(&ctx, result);
+	if (result == NULL)
+	{
+		goto error;
+	}
+
+	result->stream_leaf_count = filter_stream_index(result, 0);
+
+	pool_destroy(json_pool);
 	return result;
 	
 error:
 
+	pool_destroy(json_pool);
+	pool_destroy(ctx.pool);
 	error[error_size - 1] = '\0';			// make sure it's null terminated
 	return NULL;
 }
@@ -2,13 +2,33 @@
 #define __FILTER_H__
 
 // includes
+#include <stdio.h>
 #include "../common.h"
 
+// enums
+enum {
+	FILTER_STREAM_FALSE,
+	FILTER_STREAM_TRUE,
+	FILTER_STREAM_UNKNOWN,
+};
+
 // typedefs
 typedef struct filter_base_s filter_base_t;
+typedef struct filter_stream_s filter_stream_t;
 
 // functions
 filter_base_t* filter_parse(char* str, char* error, size_t error_size);
 bool_t filter_eval(filter_base_t* filter, char* data, size_t len);
+void filter_stats_enable(filter_base_t* filter);
+void filter_stats_print(filter_base_t* filter, FILE* fp);
+void filter_thread_cleanup();
+
+// stream - chunked evaluation of blocks that can't be kept in memory as a whole
+filter_stream_t* filter_stream_create(filter_base_t* filter);
+size_t filter_stream_overlap(filter_stream_t* stream);
+int filter_stream_start(filter_stream_t* stream, char* data, size_t len);
+int filter_stream_write(filter_stream_t* stream, char* data, size_t len);
+bool_t filter_stream_end(filter_stream_t* stream, char* data, size_t len);
+void filter_stream_free(filter_stream_t* stream);
 
 #endif // __FILTER_H__
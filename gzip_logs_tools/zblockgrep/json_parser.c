@@ -93,7 +93,12 @@ static json_type_t json_int = {
 static void *
 json_alloc(pool_t* pool, size_t size)
 {
-	return malloc(size);
+	if (pool == NULL)
+	{
+		return malloc(size);
+	}
+
+	return pool_alloc(pool, size);
 }
 
 static int 
@@ -102,6 +107,7 @@ json_array_init(json_array_t *array, pool_t* pool, unsigned n, size_t size)
     array->nelts = 0;
     array->size = size;
     array->nalloc = n;
+	array->pool = pool;
 
     array->elts = json_alloc(pool, n * size);
     if (array->elts == NULL) 
@@ -119,7 +125,10 @@ json_array_push(json_array_t *a)
 
 	if (a->nelts >= a->nalloc)
 	{
-		new_elts = realloc(a->elts, a->size * a->nalloc * 2);
+		// Note: when the array is the last allocation of the pool, it is grown in place
+		new_elts = a->pool != NULL ?
+			pool_grow(a->pool, a->elts, a->size * a->nalloc, a->size * a->nalloc * 2) :
+			realloc(a->elts, a->size * a->nalloc * 2);
 		if (new_elts == NULL)
 		{
 			return NULL;
@@ -843,3 +852,237 @@ json_decode_string(str_t* dest, str_t* src)
 
 	return JSON_OK;
 }
+
+/// path lookup
+/*
+	Finds the value of a key path (e.g. a.b) in a json object, without allocating memory or
+	modifying the data. The data does not have to be null terminated. Only the keys along the
+	path are compared, the values of other keys are skipped without parsing them, and the scan
+	stops once the path is found. The object may be preceded by other text (e.g. a timestamp),
+	the scan starts at the first {.
+	Note: the keys are compared as is (case sensitive, without decoding escape sequences)
+*/
+typedef struct {
+	char* cur_pos;
+	char* end_pos;
+} json_scanner_t;
+
+static void
+json_scanner_skip_spaces(json_scanner_t* state)
+{
+	for (; state->cur_pos < state->end_pos && isspace(*state->cur_pos); state->cur_pos++);
+}
+
+static json_status_t
+json_scanner_string(json_scanner_t* state, str_t* result)
+{
+	char* cur_pos;
+
+	result->data = ++state->cur_pos;		// skip the "
+
+	for (cur_pos = state->cur_pos; cur_pos < state->end_pos; cur_pos++)
+	{
+		switch (*cur_pos)
+		{
+		case '\\':
+			cur_pos++;
+			break;
+
+		case '"':
+			result->len = cur_pos - result->data;
+			state->cur_pos = cur_pos + 1;
+			return JSON_OK;
+		}
+	}
+
+	return JSON_BAD_DATA;
+}
+
+static json_status_t
+json_scanner_container(json_scanner_t* state)
+{
+	str_t str;
+	int depth = 0;
+
+	// Note: the nesting is not validated, only the extent of the value is needed
+	while (state->cur_pos < state->end_pos)
+	{
+		switch (*state->cur_pos)
+		{
+		case '"':
+			if (json_scanner_string(state, &str) != JSON_OK)
+			{
+				return JSON_BAD_DATA;
+			}
+			continue;
+
+		case '{':
+		case '[':
+			depth++;
+			break;
+
+		case '}':
+		case ']':
+			depth--;
+			if (depth <= 0)
+			{
+				state->cur_pos++;
+				return JSON_OK;
+			}
+			break;
+		}
+
+		state->cur_pos++;
+	}
+
+	return JSON_BAD_DATA;
+}
+
+static json_status_t
+json_scanner_value(json_scanner_t* state, json_raw_value_t* result)
+{
+	char* start_pos = state->cur_pos;
+	json_status_t rc;
+
+	if (start_pos >= state->end_pos)
+	{
+		return JSON_BAD_DATA;
+	}
+
+	switch (*start_pos)
+	{
+	case '"':
+		result->type = JSON_STRING;
+		return json_scanner_string(state, &result->raw);
+
+	case '{':
+	case '[':
+		result->type = *start_pos == '{' ? JSON_OBJECT : JSON_ARRAY;
+		rc = json_scanner_container(state);
+		result->raw.data = start_pos;
+		result->raw.len = state->cur_pos - start_pos;
+		return rc;
+	}
+
+	// literal / number, runs until a delimiter
+	for (; state->cur_pos < state->end_pos; state->cur_pos++)
+	{
+		if (*state->cur_pos == ',' || *state->cur_pos == '}' || *state->cur_pos == ']' || isspace(*state->cur_pos))
+		{
+			break;
+		}
+	}
+
+	result->raw.data = start_pos;
+	result->raw.len = state->cur_pos - start_pos;
+
+	switch (*start_pos)
+	{
+	case 'n':
+		result->type = JSON_NULL;
+		return result->raw.len == sizeof("null") - 1 && memcmp(start_pos, "null", result->raw.len) == 0 ? JSON_OK : JSON_BAD_DATA;
+
+	case 't':
+		result->type = JSON_BOOL;
+		return result->raw.len == sizeof("true") - 1 && memcmp(start_pos, "true", result->raw.len) == 0 ? JSON_OK : JSON_BAD_DATA;
+
+	case 'f':
+		result->type = JSON_BOOL;
+		return result->raw.len == sizeof("false") - 1 && memcmp(start_pos, "false", result->raw.len) == 0 ? JSON_OK : JSON_BAD_DATA;
+	}
+
+	if (*start_pos != '-' && !isdigit(*start_pos))
+	{
+		return JSON_BAD_DATA;
+	}
+
+	result->type = memchr(start_pos, '.', result->raw.len) != NULL ||
+		memchr(start_pos, 'e', result->raw.len) != NULL ||
+		memchr(start_pos, 'E', result->raw.len) != NULL ? JSON_FRAC : JSON_INT;
+	return JSON_OK;
+}
+
+json_status_t
+json_get_path_raw_value(str_t* data, str_t* path, size_t path_count, json_raw_value_t* result)
+{
+	json_scanner_t state;
+	json_status_t rc;
+	str_t key;
+	size_t i;
+
+	state.cur_pos = memchr(data->data, '{', data->len);
+	if (state.cur_pos == NULL)
+	{
+		return JSON_NOT_FOUND;
+	}
+	state.end_pos = data->data + data->len;
+
+	for (i = 0; i < path_count; i++)
+	{
+		if (state.cur_pos >= state.end_pos || *state.cur_pos != '{')
+		{
+			return JSON_NOT_FOUND;		// not an object
+		}
+		state.cur_pos++;
+
+		// find the key in the object
+		for (;;)
+		{
+			json_scanner_skip_spaces(&state);
+			if (state.cur_pos >= state.end_pos)
+			{
+				return JSON_BAD_DATA;
+			}
+
+			if (*state.cur_pos == '}')
+			{
+				return JSON_NOT_FOUND;
+			}
+
+			if (*state.cur_pos != '"' ||
+				json_scanner_string(&state, &key) != JSON_OK)
+			{
+				return JSON_BAD_DATA;
+			}
+
+			json_scanner_skip_spaces(&state);
+			if (state.cur_pos >= state.end_pos || *state.cur_pos != ':')
+			{
+				return JSON_BAD_DATA;
+			}
+			state.cur_pos++;
+			json_scanner_skip_spaces(&state);
+
+			if (key.len == path[i].len && memcmp(key.data, path[i].data, key.len) == 0)
+			{
+				break;
+			}
+
+			rc = json_scanner_value(&state, result);
+			if (rc != JSON_OK)
+			{
+				return rc;
+			}
+
+			json_scanner_skip_spaces(&state);
+			if (state.cur_pos >= state.end_pos)
+			{
+				return JSON_BAD_DATA;
+			}
+
+			switch (*state.cur_pos)
+			{
+			case ',':
+				state.cur_pos++;
+				continue;
+
+			case '}':
+				return JSON_NOT_FOUND;
+			}
+
+			return JSON_BAD_DATA;
+		}
+	}
+
+	return json_scanner_value(&state, result);
+}
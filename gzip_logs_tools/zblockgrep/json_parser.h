@@ -5,6 +5,7 @@
 #include <sys/types.h>
 #include <stdint.h>
 #include "../common.h"
+#include "pool.h"
 
 // enums
 enum {
@@ -23,11 +24,11 @@ enum {
 	JSON_ALLOC_FAILED = -2,
 	JSON_BAD_LENGTH = -3,
 	JSON_BAD_TYPE = -4,
+	JSON_NOT_FOUND = -5,
 };
 
 // typedefs
 typedef intptr_t json_status_t;
-typedef void pool_t;
 
 typedef struct {
 	int64_t num;
@@ -60,6 +61,11 @@ typedef struct {
 	} v;
 } json_value_t;
 
+typedef struct {
+	int type;
+	str_t raw;			// the text of the value, strings are escaped and do not include the quotes
+} json_raw_value_t;
+
 typedef struct {
 	uintptr_t key_hash;
 	str_t key;
@@ -76,4 +82,10 @@ json_status_t json_parse(
 
 json_status_t json_decode_string(str_t* dest, str_t* src);
 
+json_status_t json_get_path_raw_value(
+	str_t* data,
+	str_t* path,
+	size_t path_count,
+	json_raw_value_t* result);
+
 #endif // __JSON_PARSER_H__
@@ -0,0 +1,147 @@
+#include <stdlib.h>
+#include <string.h>
+#include "pool.h"
+
+// macros
+#define pool_align(x) (((x) + POOL_ALIGNMENT - 1) & ~((size_t)POOL_ALIGNMENT - 1))
+
+// typedefs
+typedef struct pool_block_s {
+	struct pool_block_s* next;
+	u_char* end;
+} pool_block_t;
+
+struct pool_s {
+	pool_block_t* first;
+	pool_block_t* cur;
+	u_char* pos;			// the next free byte in cur
+	u_char* last;			// the last allocation, can be grown in place
+	size_t block_size;
+};
+
+// Note: the pool header is allocated in front of the first block
+#define POOL_HEADER_SIZE pool_align(sizeof(pool_t))
+#define POOL_BLOCK_HEADER_SIZE pool_align(sizeof(pool_block_t))
+
+#define pool_block_data(block) ((u_char*)(block) + POOL_BLOCK_HEADER_SIZE)
+
+pool_t*
+pool_create(size_t block_size)
+{
+	pool_block_t* block;
+	pool_t* pool;
+
+	block_size = pool_align(block_size);
+
+	pool = malloc(POOL_HEADER_SIZE + POOL_BLOCK_HEADER_SIZE + block_size);
+	if (pool == NULL)
+	{
+		return NULL;
+	}
+
+	block = (pool_block_t*)((u_char*)pool + POOL_HEADER_SIZE);
+	block->next = NULL;
+	block->end = pool_block_data(block) + block_size;
+
+	pool->first = block;
+	pool->block_size = block_size;
+	pool_reset(pool);
+	return pool;
+}
+
+static void*
+pool_alloc_block(pool_t* pool, size_t size)
+{
+	pool_block_t* block;
+	size_t block_size;
+
+	// use the next block when it is large enough (a block that was kept by pool_reset)
+	block = pool->cur->next;
+	if (block == NULL || pool_block_data(block) + size > block->end)
+	{
+		block_size = max(pool->block_size, size);
+
+		block = malloc(POOL_BLOCK_HEADER_SIZE + block_size);
+		if (block == NULL)
+		{
+			return NULL;
+		}
+
+		block->end = pool_block_data(block) + block_size;
+		block->next = pool->cur->next;
+		pool->cur->next = block;
+	}
+
+	pool->cur = block;
+	pool->last = pool_block_data(block);
+	pool->pos = pool->last + size;
+	return pool->last;
+}
+
+void*
+pool_alloc(pool_t* pool, size_t size)
+{
+	size = pool_align(size);
+
+	if (size > (size_t)(pool->cur->end - pool->pos))
+	{
+		return pool_alloc_block(pool, size);
+	}
+
+	pool->last = pool->pos;
+	pool->pos += size;
+	return pool->last;
+}
+
+void*
+pool_grow(pool_t* pool, void* ptr, size_t old_size, size_t new_size)
+{
+	void* result;
+
+	if (ptr == pool->last && ptr != NULL &&
+		pool_align(new_size) <= (size_t)(pool->cur->end - pool->last))
+	{
+		pool->pos = pool->last + pool_align(new_size);
+		return ptr;
+	}
+
+	result = pool_alloc(pool, new_size);
+	if (result == NULL)
+	{
+		return NULL;
+	}
+
+	if (ptr != NULL)
+	{
+		memcpy(result, ptr, min(old_size, new_size));
+	}
+	return result;
+}
+
+void
+pool_reset(pool_t* pool)
+{
+	pool->cur = pool->first;
+	pool->pos = pool_block_data(pool->first);
+	pool->last = NULL;
+}
+
+void
+pool_destroy(pool_t* pool)
+{
+	pool_block_t* block;
+	pool_block_t* next;
+
+	if (pool == NULL)
+	{
+		return;
+	}
+
+	for (block = pool->first->next; block != NULL; block = next)
+	{
+		next = block->next;
+		free(block);
+	}
+
+	free(pool);
+}
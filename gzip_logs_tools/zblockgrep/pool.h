@@ -0,0 +1,32 @@
+#ifndef __POOL_H__
+#define __POOL_H__
+
+// includes
+#include "../common.h"
+
+/*
+	Bump pointer arena - allocations are carved sequentially from large blocks, and are freed
+	together, by pool_reset (the blocks are kept for reuse) or pool_destroy. The last allocation
+	can be grown in place while its block has room (see pool_grow), so that an array that is
+	built incrementally is not copied on every growth.
+	A pool is not thread safe.
+*/
+
+// constants
+#define POOL_ALIGNMENT (16)		// enough for any type, including long double
+
+// typedefs
+typedef struct pool_s pool_t;
+
+// functions
+pool_t* pool_create(size_t block_size);
+
+void* pool_alloc(pool_t* pool, size_t size);
+
+void* pool_grow(pool_t* pool, void* ptr, size_t old_size, size_t new_size);
+
+void pool_reset(pool_t* pool);
+
+void pool_destroy(pool_t* pool);
+
+#endif // __POOL_H__
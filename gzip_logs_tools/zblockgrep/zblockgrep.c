@@ -3,14 +3,33 @@ typedef unsigned char u_char;
 
 #include <sys/sysinfo.h>
 #include <pthread.h>
+#include <unistd.h>
 #include <getopt.h>
+#include <limits.h>
 #include <string.h>
+#include <ctype.h>
+#include <errno.h>
 #include <sched.h>
 #include <time.h>
-#include <pcre.h>
 #include "../compressed_file.h"
 #include "../capture_expression.h"
+#include "../pcre_ext.h"
 #include "filter.h"
+#include "pool.h"
+
+// constants
+#define SPLIT_MIN_RANGE_SIZE (64 * 1024 * 1024)		// min compressed size of each range, when splitting a file
+#define OUTPUT_BUFFER_INITIAL_SIZE (256 * 1024)
+#define OUTPUT_BUFFER_FLUSH_SIZE (64 * 1024)			// the buffer is written at block end, once it reaches this size
+#define OUTPUT_BUFFER_MAX_SIZE (16 * 1024 * 1024)		// larger blocks are written in parts
+#define BLOCK_BUFFER_INITIAL_SIZE (64 * 1024)
+#define BLOCK_BUFFER_DEFAULT_MAX_SIZE (16 * 1024 * 1024)	// larger blocks are filtered in chunks
+#define GROUP_MAP_INITIAL_BUCKETS (1024)				// must be a power of 2
+#define GROUP_POOL_BLOCK_SIZE (64 * 1024)
+#define GROUP_MAX_KEY_LEN (1024)						// longer group by values are truncated
+#define GROUP_MAX_VALUE_LEN (64)						// longer min / max values are truncated
+#define PREFETCH_DEFAULT_BUFFERS (16)					// 1MB each, see compressed_file_set_pipeline
+#define MAX_CONNECTIONS (64)							// per file / range, see compressed_file_set_connections
 
 // enums
 enum {
@@ -30,12 +49,86 @@ typedef struct {
 } regex_t;
 
 typedef struct {
-	pthread_t thread;
+	FILE* fp;					// NULL = not started, stdout once the output of the previous ranges was written
+	bool_t done;
+} range_output_t;
 
-	char** files;
+typedef struct {
+	range_output_t* ranges;
+	long count;
+	long next;					// the first range whose output was not fully written
+} split_file_t;
+
+typedef struct {
+	const char* file_name;
+	long file_index;
+	long file_size;				// -1 = unknown, the size of the whole file also in split files
+	split_file_t* split;		// NULL = the file is processed as a whole
+	long range_index;
 	long start;
-	long max;
-	long increment;
+	long end;					// 0 = end of file
+} work_item_t;
+
+typedef struct {
+	work_item_t* items;
+	long count;
+	volatile unsigned long next;	// the next item to process, updated atomically
+} work_queue_t;
+
+typedef struct {
+	curl_ext_conf_t* conf;
+	char** files;
+	long* sizes;
+	long count;
+	volatile unsigned long next;	// the next file to probe, updated atomically
+} size_probe_t;
+
+typedef struct {
+	u_char* data;
+	size_t size;
+	size_t alloc;
+} output_buffer_t;
+
+typedef struct {
+	u_char* data;
+	size_t alloc;
+	filter_stream_t* filter_stream;	// used for blocks that are larger than max_block_size
+	FILE* spill;				// the data of such blocks, until the filter result is known
+} block_buffer_t;
+
+typedef struct {
+	uint64_t inflated;			// uncompressed bytes
+	uint64_t lines;
+	uint64_t blocks;
+	uint64_t output_blocks;
+} file_stats_t;
+
+typedef struct group_entry_s {
+	struct group_entry_s* next;
+	uint32_t hash;
+	uint64_t count;
+	size_t min_len;
+	size_t max_len;
+	char min[GROUP_MAX_VALUE_LEN];
+	char max[GROUP_MAX_VALUE_LEN];
+	size_t key_len;
+	char key[1];
+} group_entry_t;
+
+typedef struct {
+	pool_t* pool;
+	group_entry_t** buckets;
+	size_t bucket_count;
+	size_t count;
+} group_map_t;
+
+typedef struct {
+	pthread_t thread;
+
+	work_queue_t* queue;
+	output_buffer_t output;
+	block_buffer_t block_buffer;
+	group_map_t groups;			// count mode only
 
 	int file_name_prefix;
 	curl_ext_conf_t* conf;
@@ -43,6 +136,17 @@ typedef struct {
 
 // globals
 static int show_help = 0;
+static int show_stats = 0;
+static file_stats_t* file_stats = NULL;		// per input file, allocated when show_stats is set
+static int sorted_mode = 0;
+static int count_mode = 0;
+static capture_expression_t* group_by = NULL;
+static capture_expression_t* min_max = NULL;
+static int group_max_capture_index = -1;		// the largest capture index of group_by / min_max
+static long sorted_max_failures = 0;			// 0 = stop only at the first block of a gzip member
+static size_t max_block_size = BLOCK_BUFFER_DEFAULT_MAX_SIZE;
+static long prefetch_buffers = 0;				// 0 = the input is processed by the thread that reads it
+static long connections = 1;
 
 static regex_t regex;
 static filter_base_t* filter = NULL;
@@ -51,6 +155,15 @@ static size_t block_delimiter_len = 0;
 static const char* time_format = "%Y-%m-%d %H:%M:%S";
 
 // constants
+enum {
+	SORTED_OPTION = CHAR_MAX + 1,
+	GROUP_BY_OPTION,
+	MIN_MAX_OPTION,
+	MAX_BLOCK_SIZE_OPTION,
+	PREFETCH_OPTION,
+	CONNECTIONS_OPTION,
+};
+
 static char const short_options[] = "i:p:t:c:f:d:T:hH";
 static struct option const long_options[] =
 {
@@ -64,6 +177,14 @@ static struct option const long_options[] =
 	{"no-filename", no_argument, NULL, 'h'},
 	{"with-filename", no_argument, NULL, 'H'},
 	{"help", no_argument, &show_help, 1},
+	{"stats", no_argument, &show_stats, 1},
+	{"sorted", optional_argument, NULL, SORTED_OPTION},
+	{"count", no_argument, &count_mode, 1},
+	{"group-by", required_argument, NULL, GROUP_BY_OPTION},
+	{"min-max", required_argument, NULL, MIN_MAX_OPTION},
+	{"max-block-size", required_argument, NULL, MAX_BLOCK_SIZE_OPTION},
+	{"prefetch", optional_argument, NULL, PREFETCH_OPTION},
+	{"connections", required_argument, NULL, CONNECTIONS_OPTION},
 	{0, 0, 0, 0}
 };
 
@@ -83,11 +204,28 @@ enum {
 	CONDITION_GREATER_EQUAL,
 };
 
+enum {
+	CONDITION_RESULT_NO_MATCH,
+	CONDITION_RESULT_MATCH,
+	CONDITION_RESULT_ABOVE_BOUND,		// a sorted bound condition failed, the value is greater than the reference
+};
+
+// in sorted mode, the values of $1 are assumed to be non decreasing within each file
+#define capture_condition_is_sorted_bound(cond)			\
+	((cond)->capture_expression == NULL &&				\
+	(cond)->capture_index == 0 &&						\
+	((cond)->comparison == CONDITION_EQUALS ||			\
+	(cond)->comparison == CONDITION_LESS_THAN ||		\
+	(cond)->comparison == CONDITION_LESS_EQUAL))
+
 typedef struct capture_condition_s capture_condition_t;
 
 typedef int (*compare_func_t)(capture_condition_t* cond, const char* str, size_t len);
 
 struct capture_condition_s {
+	const char* text;
+	size_t text_len;
+	eval_stats_t stats;
 	capture_expression_t* capture_expression;
 	int capture_index;
 	int comparison;
@@ -100,6 +238,7 @@ struct capture_condition_s {
 		long double num;
 		time_t time;
 	} u;
+	int64_t time_key;				// the reference time, when fast_time_compare is used
 };
 
 static capture_condition_t* capture_conditions = NULL;
@@ -165,6 +304,82 @@ time_compare(capture_condition_t* cond, const char* str, size_t len)
 	return (int)time - (int)cond->u.time;
 }
 
+/*
+	Fast path for the default time format - the captured value is compared using a fixed layout
+	digit parser, instead of strptime + mktime. Values that do not match the layout, or that fail
+	the range checks of strptime, fall back to time_compare.
+	Note: the key counts seconds since the epoch, ignoring the time zone - mktime is called with
+	tm_isdst = 0, so the local time offset is the same for all values. Out of range days / seconds
+	(e.g. 02-31, 23:59:60) are normalized the same way mktime normalizes them.
+*/
+#define FAST_TIME_FORMAT "%Y-%m-%d %H:%M:%S"
+#define FAST_TIME_LEN (sizeof("YYYY-MM-DD HH:MM:SS") - 1)
+
+#define fast_time_digits2(p) (((p)[0] - '0') * 10 + ((p)[1] - '0'))
+
+static bool_t
+parse_fast_time(const char* str, size_t len, int64_t* result)
+{
+	static const char digit_pos[] = { 0, 1, 2, 3, 5, 6, 8, 9, 11, 12, 14, 15, 17, 18 };
+	int64_t year, month, day;
+	int64_t era, yoe, doy, doe;
+	int hour, min, sec;
+	size_t i;
+
+	if (len < FAST_TIME_LEN ||
+		str[4] != '-' || str[7] != '-' || str[10] != ' ' || str[13] != ':' || str[16] != ':')
+	{
+		return FALSE;
+	}
+
+	for (i = 0; i < sizeof(digit_pos); i++)
+	{
+		if ((u_char)(str[(int)digit_pos[i]] - '0') > 9)
+		{
+			return FALSE;
+		}
+	}
+
+	year = fast_time_digits2(str) * 100 + fast_time_digits2(str + 2);
+	month = fast_time_digits2(str + 5);
+	day = fast_time_digits2(str + 8);
+	hour = fast_time_digits2(str + 11);
+	min = fast_time_digits2(str + 14);
+	sec = fast_time_digits2(str + 17);
+
+	// the ranges accepted by strptime
+	if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || min > 59 || sec > 61)
+	{
+		return FALSE;
+	}
+
+	// days since the epoch (days_from_civil, http://howardhinnant.github.io/date_algorithms.html)
+	if (month <= 2)
+	{
+		year--;
+	}
+	era = (year >= 0 ? year : year - 399) / 400;
+	yoe = year - era * 400;
+	doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	*result = ((era * 146097 + doe - 719468) * 24 + hour) * 3600 + min * 60 + sec;
+	return TRUE;
+}
+
+static int
+fast_time_compare(capture_condition_t* cond, const char* str, size_t len)
+{
+	int64_t key;
+
+	if (!parse_fast_time(str, len, &key))
+	{
+		return time_compare(cond, str, len);
+	}
+
+	return key < cond->time_key ? -1 : key > cond->time_key ? 1 : 0;
+}
+
 static bool_t
 parse_general_num(const char* str, size_t len, long double* result)
 {
@@ -230,10 +445,10 @@ capture_conditions_parse(const char* str)
 		}
 	}
 
-	result = malloc(sizeof(result[0]) * (count + 2));
+	result = calloc(count + 2, sizeof(result[0]));
 	if (result == NULL)
 	{
-		error(0, "malloc failed");
+		error(0, "calloc failed");
 		return NULL;
 	}
 
@@ -241,6 +456,8 @@ capture_conditions_parse(const char* str)
 	pos = str;
 	for (;;)
 	{
+		cur->text = pos;
+
 		switch (*pos++)
 		{
 		case '$':
@@ -342,6 +559,8 @@ capture_conditions_parse(const char* str)
 			value_len = comma_pos - pos;
 		}
 
+		cur->text_len = value + value_len - cur->text;
+
 		switch (compare_type)
 		{
 		case COMPARE_TYPE_TIME:
@@ -350,6 +569,14 @@ capture_conditions_parse(const char* str)
 				error(0, "failed to parse reference time");
 				goto error;
 			}
+
+			if (strcmp(time_format, FAST_TIME_FORMAT) == 0 &&
+				parse_fast_time(value, value_len, &cur->time_key))
+			{
+				cur->comparison_func = fast_time_compare;
+				break;
+			}
+
 			cur->comparison_func = time_compare;
 			break;
 
@@ -386,226 +613,1416 @@ error:
 	return NULL;
 }
 
-static bool_t
-capture_conditions_eval(const char* buffer, int* captures, int exec_result)
+static int
+capture_condition_sorted_bound_result(capture_condition_t* cur, int compare_result)
+{
+	if (sorted_mode && compare_result > 0 && capture_condition_is_sorted_bound(cur))
+	{
+		return CONDITION_RESULT_ABOVE_BOUND;
+	}
+
+	return CONDITION_RESULT_NO_MATCH;
+}
+
+static int
+capture_condition_eval(capture_condition_t* cur, const char* buffer, int* captures, int exec_result)
 {
-	capture_condition_t* cur;
 	const char* value;
 	char buf[1024];
 	size_t value_len;
-	bool_t cur_result;
 	int value_start;
 	int compare_result;
 
-	if (capture_conditions == NULL)
+	if (exec_result < cur->capture_index + 2)
 	{
-		return TRUE;
+		return CONDITION_RESULT_NO_MATCH;
 	}
 
-	for (cur = capture_conditions; cur->comparison != CONDITION_NONE; cur++)
+	if (cur->capture_expression != NULL)
 	{
-		if (exec_result < cur->capture_index + 2)
+		value_len = eval_capture_expression(
+			cur->capture_expression,
+			buf,
+			sizeof(buf),
+			buffer,
+			captures);
+		value = buf;
+	}
+	else
+	{
+		value_start = captures[(cur->capture_index + 1) * 2];
+		value_len = captures[(cur->capture_index + 1) * 2 + 1] - value_start;
+		value = buffer + value_start;
+	}
+
+	// optimization for string '=' - no need to run compare if the lengths are different
+	if (cur->comparison_func == string_compare &&
+		cur->comparison == CONDITION_EQUALS)
+	{
+		if (value_len == cur->u.str.len &&
+			memcmp(value, cur->u.str.data, value_len) == 0)
 		{
-			return FALSE;
+			return CONDITION_RESULT_MATCH;
 		}
 
-		if (cur->capture_expression != NULL)
+		return capture_condition_sorted_bound_result(cur, sorted_mode ? string_compare(cur, value, value_len) : 0);
+	}
+
+	compare_result = cur->comparison_func(cur, value, value_len);
+
+	switch (cur->comparison)
+	{
+	case CONDITION_EQUALS:
+		if (compare_result == 0)
 		{
-			value_len = eval_capture_expression(
-				cur->capture_expression,
-				buf,
-				sizeof(buf),
-				buffer,
-				captures);
-			value = buf;
+			return CONDITION_RESULT_MATCH;
 		}
-		else
+		break;
+
+	case CONDITION_LESS_THAN:
+		if (compare_result < 0)
 		{
-			value_start = captures[(cur->capture_index + 1) * 2];
-			value_len = captures[(cur->capture_index + 1) * 2 + 1] - value_start;
-			value = buffer + value_start;
+			return CONDITION_RESULT_MATCH;
 		}
+		break;
 
-		// optimization for string '=' - no need to run compare if the lengths are different
-		if (cur->comparison_func == string_compare &&
-			cur->comparison == CONDITION_EQUALS)
+	case CONDITION_LESS_EQUAL:
+		if (compare_result <= 0)
 		{
-			if (value_len == cur->u.str.len &&
-				memcmp(value, cur->u.str.data, value_len) == 0)
-			{
-				continue;
-			}
-
-			return FALSE;
+			return CONDITION_RESULT_MATCH;
 		}
+		break;
 
-		compare_result = cur->comparison_func(cur, value, value_len);
+	case CONDITION_GREATER_THAN:
+		return compare_result > 0 ? CONDITION_RESULT_MATCH : CONDITION_RESULT_NO_MATCH;
 
-		switch (cur->comparison)
-		{
-		case CONDITION_EQUALS:
-			cur_result = compare_result == 0;
-			break;
+	case CONDITION_GREATER_EQUAL:
+		return compare_result >= 0 ? CONDITION_RESULT_MATCH : CONDITION_RESULT_NO_MATCH;
 
-		case CONDITION_LESS_THAN:
-			cur_result = compare_result < 0;
-			break;
+	default:
+		return CONDITION_RESULT_NO_MATCH;
+	}
 
-		case CONDITION_LESS_EQUAL:
-			cur_result = compare_result <= 0;
-			break;
+	return capture_condition_sorted_bound_result(cur, compare_result);
+}
 
-		case CONDITION_GREATER_THAN:
-			cur_result = compare_result > 0;
-			break;
+static int
+capture_conditions_eval(const char* buffer, int* captures, int exec_result)
+{
+	capture_condition_t* cur;
+	uint64_t start;
+	int result;
 
-		case CONDITION_GREATER_EQUAL:
-			cur_result = compare_result >= 0;
-			break;
+	if (capture_conditions == NULL)
+	{
+		return CONDITION_RESULT_MATCH;
+	}
 
-		default:
-			cur_result = FALSE;
-			break;
+	for (cur = capture_conditions; cur->comparison != CONDITION_NONE; cur++)
+	{
+		if (!show_stats)
+		{
+			result = capture_condition_eval(cur, buffer, captures, exec_result);
+			if (result != CONDITION_RESULT_MATCH)
+			{
+				return result;
+			}
+			continue;
 		}
 
-		if (!cur_result)
+		start = get_cycles();
+		result = capture_condition_eval(cur, buffer, captures, exec_result);
+		eval_stats_update(&cur->stats, result == CONDITION_RESULT_MATCH, start);
+		if (result != CONDITION_RESULT_MATCH)
 		{
-			return FALSE;
+			return result;
 		}
 	}
 
-	return TRUE;
+	return CONDITION_RESULT_MATCH;
 }
 
-
-/// spinlock implementation from nginx
-typedef intptr_t        ngx_int_t;
-typedef uintptr_t       ngx_uint_t;
-
-typedef long                        ngx_atomic_int_t;
-typedef unsigned long               ngx_atomic_uint_t;
-
-typedef volatile ngx_atomic_uint_t  ngx_atomic_t;
-
-#define ngx_atomic_cmp_set(lock, old, set)                                    \
-    __sync_bool_compare_and_swap(lock, old, set)
-
-#define ngx_atomic_fetch_add(value, add)                                      \
-    __sync_fetch_and_add(value, add)
-
-#define ngx_sched_yield()  sched_yield()
-
-#define ngx_cpu_pause()             __asm__ ("pause")
-
-#define ngx_unlock(lock)    *(lock) = 0
-
-ngx_int_t    ngx_ncpu;
-
 static void
-ngx_spinlock(ngx_atomic_t *lock, ngx_atomic_int_t value, ngx_uint_t spin)
+capture_conditions_sorted_bounds_first()
 {
-    ngx_uint_t  i, n;
-
-    for (;; ) {
-
-        if (*lock == 0 && ngx_atomic_cmp_set(lock, 0, value)) {
-            return;
-        }
+	capture_condition_t* dest;
+	capture_condition_t* cur;
+	capture_condition_t temp;
 
-        if (ngx_ncpu > 1) {
+	// in sorted mode, the bound conditions are evaluated on every block start (stable reorder)
+	dest = capture_conditions;
+	for (cur = capture_conditions; cur->comparison != CONDITION_NONE; cur++)
+	{
+		if (!capture_condition_is_sorted_bound(cur))
+		{
+			continue;
+		}
 
-            for (n = 1; n < spin; n <<= 1) {
+		temp = *cur;
+		memmove(dest + 1, dest, (cur - dest) * sizeof(*cur));
+		*dest++ = temp;
+	}
+}
 
-                for (i = 0; i < n; i++) {
-                    ngx_cpu_pause();
-                }
+static void
+capture_conditions_print_stats(FILE* fp)
+{
+	capture_condition_t* cur;
 
-                if (*lock == 0 && ngx_atomic_cmp_set(lock, 0, value)) {
-                    return;
-                }
-            }
-        }
+	if (capture_conditions == NULL)
+	{
+		return;
+	}
 
-        ngx_sched_yield();
-    }
+	fprintf(fp, "capture conditions:\n");
+	for (cur = capture_conditions; cur->comparison != CONDITION_NONE; cur++)
+	{
+		fprintf(fp, "  %.*s: evals=%" PRIu64 " matches=%" PRIu64 " cycles=%" PRIu64 "\n",
+			(int)cur->text_len, cur->text, cur->stats.evals, cur->stats.matches, cur->stats.cycles);
+	}
 }
 
-static ngx_atomic_t stdout_lock = 0;
+/// block start prefilter
+/*
+	The block start pattern is executed on every line, the prefilter rejects most non matching
+	lines without running the regex. At startup, the beginning of the pattern is translated to
+	a sequence of fixed positions - literal chars, \d and '.', for example, ^\d{4}-\d\d-\d\d
+	becomes DDDD-DD-DD. Anchored patterns are checked position by position, other patterns
+	are checked by searching the longest literal run in the line. When the whole pattern is
+	translated (e.g. the default ^.) the prefilter result is final, and the regex is not executed.
+*/
+#define PREFILTER_MAX_POSITIONS (64)
+#define PREFILTER_MAX_GROUP_DEPTH (8)
+#define PREFILTER_META_CHARS "\\^$.[]|()?*+{}"
 
-/// block processor
 enum {
-	STATE_IGNORE_BLOCK,
-	STATE_OUTPUT_BLOCK,
-	STATE_COLLECT_BLOCK,
+	PREFILTER_LITERAL,
+	PREFILTER_DIGIT,
+	PREFILTER_ANY,			// any char except newline
+};
+
+enum {
+	PREFILTER_NO_MATCH,
+	PREFILTER_CANDIDATE,	// the regex has to be executed
+	PREFILTER_MATCH,
 };
 
 typedef struct {
-	int state;
-	const char* prefix_data;
-	size_t prefix_len;
-	const char* suffix_data;
-	size_t suffix_len;
-	u_char block_buffer[65536];
-	u_char* cur_block_start;
-	u_char* cur_block_end;
-} block_processor_state_t;
+	bool_t anchored;
+	bool_t exact;
+	u_char types[PREFILTER_MAX_POSITIONS];
+	u_char chars[PREFILTER_MAX_POSITIONS];
+	size_t count;
+	u_char literal[PREFILTER_MAX_POSITIONS];
+	size_t literal_len;
+} prefilter_t;
 
-static void
-block_processor_init(
-	block_processor_state_t* state,
-	const char* prefix_data,
-	size_t prefix_len,
-	const char* suffix_data,
-	size_t suffix_len)
-{
-	state->state = STATE_IGNORE_BLOCK;
-	state->prefix_data = prefix_data;
-	state->prefix_len = prefix_len;
-	state->suffix_data = suffix_data;
-	state->suffix_len = suffix_len;
-}
+static prefilter_t prefilter;
 
 static bool_t
-block_processor_eval_filter(block_processor_state_t* state)
+prefilter_has_alternation(const char* pattern)
 {
-	if (filter != NULL &&
-		!filter_eval(filter, (char*)state->cur_block_start, state->cur_block_end - state->cur_block_start))
+	const char* p;
+
+	for (p = pattern; *p != '\0'; p++)
 	{
-		state->state = STATE_IGNORE_BLOCK;
-		return FALSE;
-	}
+		switch (*p)
+		{
+		case '\\':
+			if (p[1] == '\0')
+			{
+				return TRUE;
+			}
+			p++;
+			break;
 
-	state->state = STATE_OUTPUT_BLOCK;
+		case '[':
+			// skip the char class, a ']' right after the opening bracket is a literal
+			p++;
+			if (*p == '^')
+			{
+				p++;
+			}
+			if (*p == ']')
+			{
+				p++;
+			}
+			for (; *p != ']'; p++)
+			{
+				if (*p == '\0')
+				{
+					return TRUE;
+				}
+				if (*p == '\\' && p[1] != '\0')
+				{
+					p++;
+				}
+			}
+			break;
 
-	ngx_spinlock(&stdout_lock, 1, 2048);
+		case '|':
+			return TRUE;
+		}
+	}
 
-	if (state->prefix_len != 0)
+	return FALSE;
+}
+
+static bool_t
+prefilter_add(prefilter_t* prefilter, u_char type, u_char ch, long repeat)
+{
+	for (; repeat > 0; repeat--)
 	{
-		fwrite(state->prefix_data, state->prefix_len, 1, stdout);
-	}
-	fwrite(state->cur_block_start, state->cur_block_end - state->cur_block_start, 1, stdout);
+		if (prefilter->count >= PREFILTER_MAX_POSITIONS)
+		{
+			return FALSE;
+		}
 
-	ngx_unlock(&stdout_lock);
+		prefilter->types[prefilter->count] = type;
+		prefilter->chars[prefilter->count] = ch;
+		prefilter->count++;
+	}
 
 	return TRUE;
 }
 
 static void
-block_processor_line_start(block_processor_state_t* state, u_char* buffer, size_t size)
+prefilter_init(prefilter_t* prefilter, const char* pattern)
+{
+	size_t group_start[PREFILTER_MAX_GROUP_DEPTH];
+	size_t literal_start = 0;
+	size_t depth = 0;
+	bool_t groups = FALSE;
+	const char* p = pattern;
+	char* end;
+	long repeat;
+	size_t i;
+	size_t j;
+	u_char type;
+	u_char ch = 0;
+
+	memset(prefilter, 0, sizeof(*prefilter));
+
+	// Note: with an alternation, the beginning of the pattern does not have to match
+	if (prefilter_has_alternation(pattern))
+	{
+		return;
+	}
+
+	if (*p == '^')
+	{
+		prefilter->anchored = TRUE;
+		p++;
+	}
+
+	for (;;)
+	{
+		// parse an atom
+		switch (*p)
+		{
+		case '\0':
+			prefilter->exact = prefilter->anchored && !groups;
+			goto done;
+
+		case '(':
+			if (p[1] == '?' || depth >= PREFILTER_MAX_GROUP_DEPTH)
+			{
+				goto done;
+			}
+
+			groups = TRUE;
+			group_start[depth++] = prefilter->count;
+			p++;
+			continue;
+
+		case ')':
+			if (depth <= 0)
+			{
+				goto done;
+			}
+
+			depth--;
+			p++;
+			if (*p != '\0' && strchr("?*+{", *p) != NULL)
+			{
+				// quantified group - ignore its contents
+				prefilter->count = group_start[depth];
+				goto done;
+			}
+			continue;
+
+		case '.':
+			type = PREFILTER_ANY;
+			p++;
+			break;
+
+		case '\\':
+			if (p[1] == 'd')
+			{
+				type = PREFILTER_DIGIT;
+			}
+			else if (p[1] != '\0' && !isalnum((u_char)p[1]))
+			{
+				type = PREFILTER_LITERAL;
+				ch = p[1];
+			}
+			else
+			{
+				goto done;
+			}
+			p += 2;
+			break;
+
+		default:
+			if (strchr(PREFILTER_META_CHARS, *p) != NULL)
+			{
+				goto done;
+			}
+
+			type = PREFILTER_LITERAL;
+			ch = *p;
+			p++;
+			break;
+		}
+
+		// parse the quantifier
+		switch (*p)
+		{
+		case '?':
+		case '*':
+			goto done;
+
+		case '+':
+			prefilter_add(prefilter, type, ch, 1);
+			goto done;
+
+		case '{':
+			if (!isdigit((u_char)p[1]))
+			{
+				goto done;
+			}
+
+			repeat = strtol(p + 1, &end, 10);
+			if (*end != '}' && *end != ',')
+			{
+				goto done;
+			}
+
+			if (!prefilter_add(prefilter, type, ch, repeat) || *end != '}')
+			{
+				goto done;
+			}
+
+			p = end + 1;
+			break;
+
+		default:
+			if (!prefilter_add(prefilter, type, ch, 1))
+			{
+				goto done;
+			}
+			break;
+		}
+	}
+
+done:
+
+	// find the longest literal run
+	for (i = 0; i < prefilter->count; i = j + 1)
+	{
+		for (j = i; j < prefilter->count && prefilter->types[j] == PREFILTER_LITERAL; j++);
+
+		if (j - i > prefilter->literal_len)
+		{
+			literal_start = i;
+			prefilter->literal_len = j - i;
+		}
+	}
+
+	memcpy(prefilter->literal, prefilter->chars + literal_start, prefilter->literal_len);
+}
+
+static bool_t
+prefilter_find_literal(prefilter_t* prefilter, const u_char* buffer, size_t size)
+{
+	const u_char* literal = prefilter->literal;
+	size_t literal_len = prefilter->literal_len;
+	const u_char* last;
+	const u_char* p;
+
+	if (size < literal_len)
+	{
+		return FALSE;
+	}
+
+	// Note: memchr is vectorized by libc, the rest of the literal is compared only on a first char match
+	last = buffer + size - literal_len;
+	for (p = buffer; p <= last; p++)
+	{
+		p = memchr(p, literal[0], last - p + 1);
+		if (p == NULL)
+		{
+			return FALSE;
+		}
+
+		if (memcmp(p + 1, literal + 1, literal_len - 1) == 0)
+		{
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+static int
+prefilter_match(prefilter_t* prefilter, const u_char* buffer, size_t size)
+{
+	size_t i;
+
+	if (!prefilter->anchored)
+	{
+		if (prefilter->literal_len > 0 &&
+			!prefilter_find_literal(prefilter, buffer, size))
+		{
+			return PREFILTER_NO_MATCH;
+		}
+
+		return PREFILTER_CANDIDATE;
+	}
+
+	if (size < prefilter->count)
+	{
+		return PREFILTER_NO_MATCH;
+	}
+
+	for (i = 0; i < prefilter->count; i++)
+	{
+		switch (prefilter->types[i])
+		{
+		case PREFILTER_LITERAL:
+			if (buffer[i] != prefilter->chars[i])
+			{
+				return PREFILTER_NO_MATCH;
+			}
+			break;
+
+		case PREFILTER_DIGIT:
+			if ((u_char)(buffer[i] - '0') > 9)
+			{
+				return PREFILTER_NO_MATCH;
+			}
+			break;
+
+		default:	// PREFILTER_ANY
+			if (buffer[i] == '\n')
+			{
+				return PREFILTER_NO_MATCH;
+			}
+			break;
+		}
+	}
+
+	return prefilter->exact ? PREFILTER_MATCH : PREFILTER_CANDIDATE;
+}
+
+/// spinlock implementation from nginx
+typedef intptr_t        ngx_int_t;
+typedef uintptr_t       ngx_uint_t;
+
+typedef long                        ngx_atomic_int_t;
+typedef unsigned long               ngx_atomic_uint_t;
+
+typedef volatile ngx_atomic_uint_t  ngx_atomic_t;
+
+#define ngx_atomic_cmp_set(lock, old, set)                                    \
+    __sync_bool_compare_and_swap(lock, old, set)
+
+#define ngx_atomic_fetch_add(value, add)                                      \
+    __sync_fetch_and_add(value, add)
+
+#define ngx_sched_yield()  sched_yield()
+
+#define ngx_cpu_pause()             __asm__ ("pause")
+
+#define ngx_unlock(lock)    *(lock) = 0
+
+ngx_int_t    ngx_ncpu;
+
+static void
+ngx_spinlock(ngx_atomic_t *lock, ngx_atomic_int_t value, ngx_uint_t spin)
+{
+    ngx_uint_t  i, n;
+
+    for (;; ) {
+
+        if (*lock == 0 && ngx_atomic_cmp_set(lock, 0, value)) {
+            return;
+        }
+
+        if (ngx_ncpu > 1) {
+
+            for (n = 1; n < spin; n <<= 1) {
+
+                for (i = 0; i < n; i++) {
+                    ngx_cpu_pause();
+                }
+
+                if (*lock == 0 && ngx_atomic_cmp_set(lock, 0, value)) {
+                    return;
+                }
+            }
+        }
+
+        ngx_sched_yield();
+    }
+}
+
+static ngx_atomic_t stdout_lock = 0;
+
+static bool_t
+output_write(int fd, const u_char* data, size_t size)
+{
+	ssize_t rc;
+
+	while (size > 0)
+	{
+		rc = write(fd, data, size);
+		if (rc < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			error(errno, "write failed");
+			return FALSE;
+		}
+
+		data += rc;
+		size -= rc;
+	}
+
+	return TRUE;
+}
+
+/// split file output
+static bool_t
+split_file_output_start(split_file_t* split, long index)
+{
+	range_output_t* output = &split->ranges[index];
+	bool_t result = TRUE;
+
+	ngx_spinlock(&stdout_lock, 1, 2048);
+
+	if (output->fp == NULL)
+	{
+		// the previous ranges are still running, keep the output in a temp file
+		output->fp = tmpfile();
+		if (output->fp == NULL)
+		{
+			result = FALSE;
+		}
+	}
+
+	ngx_unlock(&stdout_lock);
+
+	if (!result)
+	{
+		error(errno, "tmpfile failed");
+	}
+
+	return result;
+}
+
+static void
+split_file_copy_output(FILE* fp)
+{
+	u_char buffer[65536];
+	ssize_t size;
+	off_t pos;
+
+	// Note: the output is written with write(), the FILE is used only for its fd
+	for (pos = 0; ; pos += size)
+	{
+		size = pread(fileno(fp), buffer, sizeof(buffer), pos);
+		if (size <= 0)
+		{
+			break;
+		}
+
+		if (!output_write(STDOUT_FILENO, buffer, size))
+		{
+			break;
+		}
+	}
+
+	fclose(fp);
+}
+
+static void
+split_file_output_end(split_file_t* split, long index)
+{
+	range_output_t* output;
+
+	ngx_spinlock(&stdout_lock, 1, 2048);
+
+	split->ranges[index].done = TRUE;
+
+	// write the output of the following ranges, in order
+	while (split->next < split->count)
+	{
+		output = &split->ranges[split->next];
+		if (output->fp != NULL && output->fp != stdout)
+		{
+			split_file_copy_output(output->fp);
+		}
+		output->fp = stdout;
+
+		if (!output->done)
+		{
+			break;
+		}
+
+		split->next++;
+	}
+
+	ngx_unlock(&stdout_lock);
+}
+
+/// group counts
+/*
+	In count mode (--count / --group-by / --min-max), the matching blocks are counted instead of
+	printed. Each thread counts the blocks in a hash map of its own, keyed by the value of the
+	group by expression, and the maps are merged when all threads are done. The entries are
+	allocated from a per thread pool. The min / max values are compared as strings, so a time
+	value should use a sortable format (e.g. the default %Y-%m-%d %H:%M:%S).
+*/
+static uint32_t
+group_hash(const char* key, size_t len)
+{
+	const u_char* cur = (const u_char*)key;
+	const u_char* end = cur + len;
+	uint32_t hash = 2166136261u;		// FNV-1a
+
+	for (; cur < end; cur++)
+	{
+		hash = (hash ^ *cur) * 16777619u;
+	}
+
+	return hash;
+}
+
+static int
+group_compare_values(const char* value1, size_t len1, const char* value2, size_t len2)
+{
+	int compare_result;
+
+	compare_result = memcmp(value1, value2, min(len1, len2));
+	if (compare_result != 0)
+	{
+		return compare_result;
+	}
+
+	return len1 < len2 ? -1 : len1 > len2 ? 1 : 0;
+}
+
+static bool_t
+group_map_init(group_map_t* map)
+{
+	map->pool = pool_create(GROUP_POOL_BLOCK_SIZE);
+	map->buckets = calloc(GROUP_MAP_INITIAL_BUCKETS, sizeof(map->buckets[0]));
+	if (map->pool == NULL || map->buckets == NULL)
+	{
+		error(0, "group map allocation failed");
+		pool_destroy(map->pool);
+		free(map->buckets);
+		return FALSE;
+	}
+
+	map->bucket_count = GROUP_MAP_INITIAL_BUCKETS;
+	map->count = 0;
+	return TRUE;
+}
+
+static void
+group_map_free(group_map_t* map)
+{
+	pool_destroy(map->pool);
+	free(map->buckets);
+}
+
+static bool_t
+group_map_grow(group_map_t* map)
+{
+	group_entry_t** buckets;
+	group_entry_t* entry;
+	group_entry_t* next;
+	size_t bucket_count;
+	size_t i;
+
+	bucket_count = map->bucket_count * 2;
+	buckets = calloc(bucket_count, sizeof(buckets[0]));
+	if (buckets == NULL)
+	{
+		return FALSE;
+	}
+
+	for (i = 0; i < map->bucket_count; i++)
+	{
+		for (entry = map->buckets[i]; entry != NULL; entry = next)
+		{
+			next = entry->next;
+			entry->next = buckets[entry->hash & (bucket_count - 1)];
+			buckets[entry->hash & (bucket_count - 1)] = entry;
+		}
+	}
+
+	free(map->buckets);
+	map->buckets = buckets;
+	map->bucket_count = bucket_count;
+	return TRUE;
+}
+
+static bool_t
+group_map_add(
+	group_map_t* map,
+	const char* key,
+	size_t key_len,
+	uint64_t count,
+	const char* min_value,
+	size_t min_len,
+	const char* max_value,
+	size_t max_len)
+{
+	group_entry_t** bucket;
+	group_entry_t* entry;
+	uint32_t hash;
+
+	hash = group_hash(key, key_len);
+	bucket = &map->buckets[hash & (map->bucket_count - 1)];
+	for (entry = *bucket; entry != NULL; entry = entry->next)
+	{
+		if (entry->hash == hash &&
+			entry->key_len == key_len &&
+			memcmp(entry->key, key, key_len) == 0)
+		{
+			break;
+		}
+	}
+
+	if (entry == NULL)
+	{
+		if (map->count >= map->bucket_count)
+		{
+			if (!group_map_grow(map))
+			{
+				return FALSE;
+			}
+			bucket = &map->buckets[hash & (map->bucket_count - 1)];
+		}
+
+		entry = pool_alloc(map->pool, sizeof(*entry) + key_len);
+		if (entry == NULL)
+		{
+			return FALSE;
+		}
+
+		entry->hash = hash;
+		entry->count = 0;
+		entry->key_len = key_len;
+		memcpy(entry->key, key, key_len);
+		entry->next = *bucket;
+		*bucket = entry;
+		map->count++;
+	}
+
+	if (min_max != NULL)
+	{
+		if (entry->count == 0 ||
+			group_compare_values(min_value, min_len, entry->min, entry->min_len) < 0)
+		{
+			entry->min_len = min(min_len, sizeof(entry->min));
+			memcpy(entry->min, min_value, entry->min_len);
+		}
+
+		if (entry->count == 0 ||
+			group_compare_values(max_value, max_len, entry->max, entry->max_len) > 0)
+		{
+			entry->max_len = min(max_len, sizeof(entry->max));
+			memcpy(entry->max, max_value, entry->max_len);
+		}
+	}
+
+	entry->count += count;
+	return TRUE;
+}
+
+static bool_t
+group_map_merge(group_map_t* dest, group_map_t* src)
+{
+	group_entry_t* entry;
+	size_t i;
+
+	for (i = 0; i < src->bucket_count; i++)
+	{
+		for (entry = src->buckets[i]; entry != NULL; entry = entry->next)
+		{
+			if (!group_map_add(dest, entry->key, entry->key_len, entry->count,
+				entry->min, entry->min_len, entry->max, entry->max_len))
+			{
+				return FALSE;
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+static int
+group_entry_compare(const void* p1, const void* p2)
+{
+	const group_entry_t* entry1 = *(const group_entry_t**)p1;
+	const group_entry_t* entry2 = *(const group_entry_t**)p2;
+
+	// largest count first, then by key
+	if (entry1->count != entry2->count)
+	{
+		return entry1->count > entry2->count ? -1 : 1;
+	}
+
+	return group_compare_values(entry1->key, entry1->key_len, entry2->key, entry2->key_len);
+}
+
+static bool_t
+group_map_print(group_map_t* map)
+{
+	group_entry_t** entries;
+	group_entry_t* entry;
+	size_t count;
+	size_t i;
+
+	if (group_by == NULL && map->count == 0)
+	{
+		printf("0\n");
+		return TRUE;
+	}
+
+	entries = malloc(sizeof(entries[0]) * max(map->count, 1));
+	if (entries == NULL)
+	{
+		error(0, "malloc failed");
+		return FALSE;
+	}
+
+	count = 0;
+	for (i = 0; i < map->bucket_count; i++)
+	{
+		for (entry = map->buckets[i]; entry != NULL; entry = entry->next)
+		{
+			entries[count++] = entry;
+		}
+	}
+
+	qsort(entries, count, sizeof(entries[0]), group_entry_compare);
+
+	for (i = 0; i < count; i++)
+	{
+		entry = entries[i];
+		printf("%" PRIu64, entry->count);
+		if (group_by != NULL)
+		{
+			printf("\t%.*s", (int)entry->key_len, entry->key);
+		}
+		if (min_max != NULL)
+		{
+			printf("\t%.*s\t%.*s", (int)entry->min_len, entry->min, (int)entry->max_len, entry->max);
+		}
+		putchar('\n');
+	}
+
+	free(entries);
+	return TRUE;
+}
+
+/// block processor
+/*
+	The data of a block is collected until the next block starts, and then the filter is
+	evaluated. When the block is contiguous in the inflate buffer, it is used in place,
+	otherwise it is copied to the block buffer of the thread, which grows up to max_block_size.
+	A block that does not fit in the buffer is filtered in chunks (see filter_stream_t) - the
+	buffer then holds the current chunk, and the data of the block is kept in a temp file
+	(the spill file) until the filter result is known.
+*/
+enum {
+	STATE_IGNORE_BLOCK,
+	STATE_OUTPUT_BLOCK,
+	STATE_COLLECT_BLOCK,
+	STATE_STREAM_BLOCK,			// the block is larger than the block buffer, the filter is evaluated in chunks
+};
+
+typedef struct {
+	int state;
+	const char* prefix_data;
+	size_t prefix_len;
+	const char* suffix_data;
+	size_t suffix_len;
+	range_output_t* output;			// NULL = stdout
+	output_buffer_t* buffer;		// the output of the thread, written at block granularity
+	group_map_t* groups;			// count mode - the counts of the thread
+	size_t group_key_len;			// count mode - the group by / min max values of the current block
+	size_t group_value_len;
+	char group_key[GROUP_MAX_KEY_LEN];
+	char group_value[GROUP_MAX_VALUE_LEN];
+	bool_t stop_at_block_start;		// the next block belongs to the next range of the file
+	bool_t member_start;			// sorted mode - no block started since the beginning of the gzip member
+	long sorted_failures;			// sorted mode - consecutive blocks that failed a bound condition
+	bool_t done;
+	file_stats_t stats;
+	block_buffer_t* block_buffer;
+	u_char* cur_block_start;
+	u_char* cur_block_end;
+	size_t stream_pos;				// stream - the size of the data at the beginning of the buffer that was spilled
+	off_t spill_size;
+} block_processor_state_t;
+
+static bool_t
+block_buffer_grow(block_buffer_t* buffer, size_t size)
+{
+	u_char* new_data;
+	size_t new_alloc;
+
+	if (buffer->alloc >= max_block_size)
+	{
+		return FALSE;
+	}
+
+	new_alloc = max(buffer->alloc * 2, size);
+	new_alloc = max(new_alloc, BLOCK_BUFFER_INITIAL_SIZE);
+	new_alloc = min(new_alloc, max_block_size);
+
+	new_data = realloc(buffer->data, new_alloc);
+	if (new_data == NULL)
+	{
+		return FALSE;		// handled like a block that exceeds the max size
+	}
+
+	buffer->data = new_data;
+	buffer->alloc = new_alloc;
+	return TRUE;
+}
+
+static void
+block_buffer_free(block_buffer_t* buffer)
+{
+	free(buffer->data);
+
+	if (buffer->filter_stream != NULL)
+	{
+		filter_stream_free(buffer->filter_stream);
+	}
+
+	if (buffer->spill != NULL)
+	{
+		fclose(buffer->spill);
+	}
+}
+
+static void
+block_processor_init(
+	block_processor_state_t* state,
+	const char* prefix_data,
+	size_t prefix_len,
+	const char* suffix_data,
+	size_t suffix_len,
+	range_output_t* output,
+	output_buffer_t* buffer,
+	block_buffer_t* block_buffer,
+	group_map_t* groups)
+{
+	state->state = STATE_IGNORE_BLOCK;
+	state->prefix_data = prefix_data;
+	state->prefix_len = prefix_len;
+	state->suffix_data = suffix_data;
+	state->suffix_len = suffix_len;
+	state->output = output;
+	state->buffer = buffer;
+	state->groups = groups;
+	state->block_buffer = block_buffer;
+	state->stop_at_block_start = FALSE;
+	state->member_start = TRUE;
+	state->sorted_failures = 0;
+	state->done = FALSE;
+	memset(&state->stats, 0, sizeof(state->stats));
+}
+
+static int
+block_processor_output(block_processor_state_t* state)
+{
+	// Note: must be called while holding stdout_lock
+	return state->output != NULL ? fileno(state->output->fp) : STDOUT_FILENO;
+}
+
+static void
+block_processor_write_buffer(block_processor_state_t* state)
+{
+	output_buffer_t* buffer = state->buffer;
+
+	if (buffer->size <= 0)
+	{
+		return;
+	}
+
+	ngx_spinlock(&stdout_lock, 1, 2048);
+
+	output_write(block_processor_output(state), buffer->data, buffer->size);
+
+	ngx_unlock(&stdout_lock);
+
+	buffer->size = 0;
+}
+
+static void
+block_processor_write(block_processor_state_t* state, const void* data, size_t size)
+{
+	output_buffer_t* buffer = state->buffer;
+	u_char* new_data;
+	size_t new_alloc;
+
+	if (buffer->size + size > buffer->alloc)
+	{
+		new_alloc = max(buffer->alloc * 2, buffer->size + size);
+		new_alloc = max(new_alloc, OUTPUT_BUFFER_INITIAL_SIZE);
+
+		new_data = new_alloc <= OUTPUT_BUFFER_MAX_SIZE ? realloc(buffer->data, new_alloc) : NULL;
+		if (new_data == NULL)
+		{
+			// the block is too big to keep in memory, write it in parts
+			block_processor_write_buffer(state);
+
+			if (size > buffer->alloc)
+			{
+				ngx_spinlock(&stdout_lock, 1, 2048);
+
+				output_write(block_processor_output(state), data, size);
+
+				ngx_unlock(&stdout_lock);
+				return;
+			}
+		}
+		else
+		{
+			buffer->data = new_data;
+			buffer->alloc = new_alloc;
+		}
+	}
+
+	memcpy(buffer->data + buffer->size, data, size);
+	buffer->size += size;
+}
+
+static void
+block_processor_block_end(block_processor_state_t* state)
+{
+	// Note: the buffer is written only between blocks, so that blocks of different threads do not interleave
+	if (state->buffer->size >= OUTPUT_BUFFER_FLUSH_SIZE)
+	{
+		block_processor_write_buffer(state);
+	}
+}
+
+static bool_t
+block_processor_output_start(block_processor_state_t* state)
+{
+	state->stats.output_blocks++;
+
+	if (count_mode)
+	{
+		// count the block instead of printing it
+		if (!group_map_add(state->groups, state->group_key, state->group_key_len, 1,
+			state->group_value, state->group_value_len, state->group_value, state->group_value_len))
+		{
+			error(0, "group_map_add failed");
+			exit(EXIT_ERROR);
+		}
+
+		state->state = STATE_IGNORE_BLOCK;
+		return FALSE;
+	}
+
+	state->state = STATE_OUTPUT_BLOCK;
+
+	if (state->prefix_len != 0)
+	{
+		block_processor_write(state, state->prefix_data, state->prefix_len);
+	}
+
+	return TRUE;
+}
+
+static void
+block_processor_spill(block_processor_state_t* state, u_char* data, size_t size)
+{
+	ssize_t rc;
+
+	if (count_mode)
+	{
+		return;		// the block is not printed
+	}
+
+	while (size > 0)
+	{
+		rc = pwrite(fileno(state->block_buffer->spill), data, size, state->spill_size);
+		if (rc <= 0)
+		{
+			if (rc < 0 && errno == EINTR)
+			{
+				continue;
+			}
+
+			error(errno, "spill file write failed");
+			exit(EXIT_ERROR);
+		}
+
+		data += rc;
+		size -= rc;
+		state->spill_size += rc;
+	}
+}
+
+static void
+block_processor_write_spill(block_processor_state_t* state)
+{
+	u_char buffer[65536];
+	ssize_t size;
+	off_t pos;
+
+	for (pos = 0; pos < state->spill_size; pos += size)
+	{
+		size = pread(fileno(state->block_buffer->spill), buffer, min(sizeof(buffer), (size_t)(state->spill_size - pos)), pos);
+		if (size <= 0)
+		{
+			error(errno, "spill file read failed");
+			exit(EXIT_ERROR);
+		}
+
+		block_processor_write(state, buffer, size);
+	}
+}
+
+static void
+block_processor_stream_keep_overlap(block_processor_state_t* state)
+{
+	block_buffer_t* buffer = state->block_buffer;
+	size_t overlap;
+
+	// the next chunk starts with the end of this one, so that matches that cross the boundary are found
+	overlap = min(filter_stream_overlap(buffer->filter_stream), buffer->alloc / 2);
+	overlap = min(overlap, (size_t)(state->cur_block_end - state->cur_block_start));
+
+	memmove(buffer->data, state->cur_block_end - overlap, overlap);
+	state->cur_block_start = buffer->data;
+	state->cur_block_end = buffer->data + overlap;
+	state->stream_pos = overlap;
+}
+
+static bool_t
+block_processor_stream_result(block_processor_state_t* state, int result)
+{
+	if (result != FILTER_STREAM_TRUE)
+	{
+		state->state = STATE_IGNORE_BLOCK;
+		return FALSE;
+	}
+
+	if (!block_processor_output_start(state))
+	{
+		return FALSE;
+	}
+
+	block_processor_write_spill(state);
+	block_processor_write(state, state->cur_block_start + state->stream_pos,
+		state->cur_block_end - state->cur_block_start - state->stream_pos);
+	return TRUE;
+}
+
+static void
+block_processor_stream_start(block_processor_state_t* state)
+{
+	block_buffer_t* buffer = state->block_buffer;
+	size_t size = state->cur_block_end - state->cur_block_start;
+	int result;
+
+	// Note: called when the buffer is full
+	if (filter == NULL)
+	{
+		result = FILTER_STREAM_TRUE;
+	}
+	else
+	{
+		if (buffer->filter_stream == NULL)
+		{
+			buffer->filter_stream = filter_stream_create(filter);
+			if (buffer->filter_stream == NULL)
+			{
+				error(0, "filter_stream_create failed");
+				exit(EXIT_ERROR);
+			}
+		}
+
+		result = filter_stream_start(buffer->filter_stream, (char*)state->cur_block_start, size);
+	}
+
+	state->stream_pos = 0;
+	state->spill_size = 0;
+
+	if (result != FILTER_STREAM_UNKNOWN)
+	{
+		block_processor_stream_result(state, result);
+		return;
+	}
+
+	// the result depends on the rest of the block
+	if (!count_mode && buffer->spill == NULL)
+	{
+		buffer->spill = tmpfile();
+		if (buffer->spill == NULL)
+		{
+			error(errno, "tmpfile failed");
+			exit(EXIT_ERROR);
+		}
+	}
+
+	block_processor_spill(state, state->cur_block_start, size);
+	block_processor_stream_keep_overlap(state);
+	state->state = STATE_STREAM_BLOCK;
+}
+
+static void
+block_processor_stream_data(block_processor_state_t* state, u_char* data, size_t size)
+{
+	block_buffer_t* buffer = state->block_buffer;
+	size_t copy_size;
+	int result;
+
+	for (;;)
+	{
+		copy_size = min(size, (size_t)(buffer->data + buffer->alloc - state->cur_block_end));
+		memcpy(state->cur_block_end, data, copy_size);
+		state->cur_block_end += copy_size;
+		data += copy_size;
+		size -= copy_size;
+
+		if (state->cur_block_end < buffer->data + buffer->alloc)
+		{
+			return;
+		}
+
+		// the buffer is full, evaluate the chunk
+		result = filter_stream_write(buffer->filter_stream, (char*)state->cur_block_start,
+			state->cur_block_end - state->cur_block_start);
+		if (result != FILTER_STREAM_UNKNOWN)
+		{
+			if (block_processor_stream_result(state, result))
+			{
+				block_processor_write(state, data, size);
+			}
+			return;
+		}
+
+		block_processor_spill(state, state->cur_block_start + state->stream_pos,
+			state->cur_block_end - state->cur_block_start - state->stream_pos);
+		block_processor_stream_keep_overlap(state);
+	}
+}
+
+static bool_t
+block_processor_stream_end(block_processor_state_t* state)
+{
+	filter_stream_t* stream = state->block_buffer->filter_stream;
+	int result;
+
+	// Note: the last chunk may hold only the overlap, it is still evaluated, since $ can match at its end
+	result = filter_stream_end(stream, (char*)state->cur_block_start,
+		state->cur_block_end - state->cur_block_start) ? FILTER_STREAM_TRUE : FILTER_STREAM_FALSE;
+
+	return block_processor_stream_result(state, result);
+}
+
+static bool_t
+block_processor_eval_filter(block_processor_state_t* state)
+{
+	if (state->state == STATE_STREAM_BLOCK)
+	{
+		return block_processor_stream_end(state);
+	}
+
+	if (filter != NULL &&
+		!filter_eval(filter, (char*)state->cur_block_start, state->cur_block_end - state->cur_block_start))
+	{
+		state->state = STATE_IGNORE_BLOCK;
+		return FALSE;
+	}
+
+	if (!block_processor_output_start(state))
+	{
+		return FALSE;
+	}
+
+	block_processor_write(state, state->cur_block_start, state->cur_block_end - state->cur_block_start);
+	return TRUE;
+}
+
+static void
+block_processor_set_group(block_processor_state_t* state, const char* buffer, int* captures, int exec_result)
+{
+	int i;
+
+	// the captures that did not participate in the match are not set by pcre, treat them as empty
+	for (i = exec_result; i <= group_max_capture_index + 1; i++)
+	{
+		captures[i * 2] = captures[i * 2 + 1] = 0;
+	}
+
+	state->group_key_len = group_by != NULL ?
+		eval_capture_expression(group_by, state->group_key, sizeof(state->group_key), buffer, captures) : 0;
+
+	state->group_value_len = min_max != NULL ?
+		eval_capture_expression(min_max, state->group_value, sizeof(state->group_value), buffer, captures) : 0;
+}
+
+static void
+block_processor_line_start(block_processor_state_t* state, u_char* buffer, size_t size)
 {
 	int captures[(1 + MAX_CAPTURES) * 3];
 	int exec_result;
+	bool_t member_start;
+	int result;
+
+	// check for block start
+	switch (prefilter_match(&prefilter, buffer, size))
+	{
+	case PREFILTER_NO_MATCH:
+		return;
+
+	case PREFILTER_MATCH:
+		captures[0] = 0;
+		captures[1] = prefilter.count;
+		exec_result = 1;
+		break;
+
+	default:
+		exec_result = pcre_ext_exec(
+			regex.code,
+			regex.extra,
+			(const char *)buffer,
+			size,
+			0,
+			0,
+			captures,
+			sizeof(captures) / sizeof(captures[0]));
+		break;
+	}
 
-	// run the regex to check for block start
-	exec_result = pcre_exec(
-		regex.code,
-		regex.extra,
-		(const char *)buffer,
-		size,
-		0,
-		0,
-		captures,
-		sizeof(captures) / sizeof(captures[0]));
 	if (exec_result < PCRE_ERROR_NOMATCH)
 	{
 		error(0, "pcre_exec failed %d", exec_result);
@@ -618,7 +2035,7 @@ block_processor_line_start(block_processor_state_t* state, u_char* buffer, size_
 		return;
 	}
 
-	if (state->state == STATE_COLLECT_BLOCK)
+	if (state->state == STATE_COLLECT_BLOCK || state->state == STATE_STREAM_BLOCK)
 	{
 		// evaluate the previous block
 		block_processor_eval_filter(state);
@@ -627,39 +2044,122 @@ block_processor_line_start(block_processor_state_t* state, u_char* buffer, size_
 	if (state->state == STATE_OUTPUT_BLOCK && state->suffix_len > 0)
 	{
 		// write the suffix
-		ngx_spinlock(&stdout_lock, 1, 2048);
+		block_processor_write(state, state->suffix_data, state->suffix_len);
+	}
 
-		fwrite(state->suffix_data, state->suffix_len, 1, stdout);
+	block_processor_block_end(state);
 
-		ngx_unlock(&stdout_lock);
+	if (state->stop_at_block_start)
+	{
+		// the block belongs to the next range
+		state->state = STATE_IGNORE_BLOCK;
+		state->done = TRUE;
+		return;
 	}
 
-	if (!capture_conditions_eval((const char *)buffer, captures, exec_result))
+	state->stats.blocks++;
+
+	member_start = state->member_start;
+	state->member_start = FALSE;
+
+	result = capture_conditions_eval((const char *)buffer, captures, exec_result);
+	if (result != CONDITION_RESULT_MATCH)
 	{
 		state->state = STATE_IGNORE_BLOCK;
+
+		if (result != CONDITION_RESULT_ABOVE_BOUND)
+		{
+			state->sorted_failures = 0;
+			return;
+		}
+
+		// sorted mode - the following blocks are above the bound as well
+		state->sorted_failures++;
+		if (member_start ||
+			(sorted_max_failures > 0 && state->sorted_failures >= sorted_max_failures))
+		{
+			state->done = TRUE;
+		}
 		return;
 	}
 
+	state->sorted_failures = 0;
+
+	if (count_mode)
+	{
+		block_processor_set_group(state, (const char *)buffer, captures, exec_result);
+	}
+
 	state->state = STATE_COLLECT_BLOCK;
 	state->cur_block_start = NULL;
 }
 
 static void
-block_processor_append_data(block_processor_state_t* state, u_char* buffer, size_t size)
+block_processor_buffer_data(block_processor_state_t* state, u_char* data, size_t size)
 {
+	block_buffer_t* buffer = state->block_buffer;
 	size_t copy_size;
+	size_t used;
+
+	// Note: the current block is kept in the block buffer
+	used = state->cur_block_end - state->cur_block_start;
+	if (used + size > buffer->alloc)
+	{
+		// on failure, the buffer is filled and the block is evaluated in chunks
+		block_buffer_grow(buffer, used + size);
+		state->cur_block_start = buffer->data;
+		state->cur_block_end = buffer->data + used;
+	}
+
+	copy_size = min(size, buffer->alloc - used);
+	memcpy(state->cur_block_end, data, copy_size);
+	state->cur_block_end += copy_size;
+
+	if (copy_size >= size)
+	{
+		return;
+	}
+
+	// the block does not fit in the buffer
+	block_processor_stream_start(state);
+
+	switch (state->state)
+	{
+	case STATE_OUTPUT_BLOCK:
+		block_processor_write(state, data + copy_size, size - copy_size);
+		break;
 
+	case STATE_STREAM_BLOCK:
+		block_processor_stream_data(state, data + copy_size, size - copy_size);
+		break;
+	}
+}
+
+static void
+block_processor_move_block(block_processor_state_t* state)
+{
+	u_char* data = state->cur_block_start;
+	size_t size = state->cur_block_end - state->cur_block_start;
+
+	// copy the current block from the inflate buffer to the block buffer
+	state->cur_block_start = state->cur_block_end = state->block_buffer->data;
+	block_processor_buffer_data(state, data, size);
+}
+
+static void
+block_processor_append_data(block_processor_state_t* state, u_char* buffer, size_t size)
+{
 	switch (state->state)
 	{
 	case STATE_IGNORE_BLOCK:
 		return;
 
 	case STATE_OUTPUT_BLOCK:
-		ngx_spinlock(&stdout_lock, 1, 2048);
-
-		fwrite(buffer, size, 1, stdout);
+		block_processor_write(state, buffer, size);
+		return;
 
-		ngx_unlock(&stdout_lock);
+	case STATE_STREAM_BLOCK:
+		block_processor_stream_data(state, buffer, size);
 		return;
 
 	case STATE_COLLECT_BLOCK:
@@ -681,83 +2181,66 @@ block_processor_append_data(block_processor_state_t* state, u_char* buffer, size
 		return;
 	}
 
-	if (state->cur_block_start != state->block_buffer)
-	{
-		// copy current block to the buffer
-		copy_size = state->cur_block_end - state->cur_block_start;
-		if (copy_size > sizeof(state->block_buffer))
-		{
-			// Note: this can't happen since the line buffer is smaller than the block buffer
-			error(0, "unexpected - not enough room in block buffer");
-			exit(1);
-		}
-
-		memcpy(state->block_buffer, state->cur_block_start, copy_size);
-		state->cur_block_start = state->block_buffer;
-		state->cur_block_end = state->block_buffer + copy_size;
-	}
-
-	// current block is kept in block buffer, copy as much as possible
-	copy_size = min(size, state->block_buffer + sizeof(state->block_buffer) - state->cur_block_end);
-	memcpy(state->cur_block_end, buffer, copy_size);
-	state->cur_block_end += copy_size;
-
-	if (state->cur_block_end < state->block_buffer + sizeof(state->block_buffer))
+	if (state->cur_block_start != state->block_buffer->data)
 	{
+		// Note: the block may not fit in the buffer, the state is rechecked after the move
+		block_processor_move_block(state);
+		block_processor_append_data(state, buffer, size);
 		return;
 	}
 
-	// buffer is full, evaluate the block
-	if (block_processor_eval_filter(state))
-	{
-		ngx_spinlock(&stdout_lock, 1, 2048);
-
-		fwrite(buffer + copy_size, size - copy_size, 1, stdout);
-
-		ngx_unlock(&stdout_lock);
-	}
+	block_processor_buffer_data(state, buffer, size);
 }
 
 static void
 block_processor_flush(block_processor_state_t* state)
 {
-	size_t size;
-
 	if (state->state != STATE_COLLECT_BLOCK ||
 		state->cur_block_start == NULL ||
-		state->cur_block_start == state->block_buffer)
-	{
-		return;
-	}
-
-	size = state->cur_block_end - state->cur_block_start;
-	if (size >= sizeof(state->block_buffer))
+		state->cur_block_start == state->block_buffer->data)
 	{
-		// cant buffer the block, evaluate it
-		block_processor_eval_filter(state);
 		return;
 	}
 
-	// save the block to the buffer
-	memcpy(state->block_buffer, state->cur_block_start, size);
-	state->cur_block_start = state->block_buffer;
-	state->cur_block_end = state->block_buffer + size;
+	// the inflate buffer is about to be reused, save the block to the buffer
+	block_processor_move_block(state);
 }
 
 /// line processor
 typedef struct {
 	block_processor_state_t* block_state;
+	compressed_file_state_t* file;
 	u_char line_buffer[32768];
 	size_t line_buffer_size;
 	bool_t line_start;
+	bool_t range_end;
 } line_processor_state_t;
 
 static void
-line_processor_init(line_processor_state_t* state, block_processor_state_t* block_state, bool_t line_start)
+line_processor_init(line_processor_state_t* state, block_processor_state_t* block_state, compressed_file_state_t* file, bool_t line_start)
 {
 	state->block_state = block_state;
+	state->file = file;
 	state->line_start = line_start;
 	state->line_buffer_size = 0;
+	state->range_end = FALSE;
+}
+
+static void
+line_processor_range_end(void* context)
+{
+	line_processor_state_t* state = context;
+
+	// the next range starts by skipping a line, this range stops at the first block that starts after it
+	state->range_end = TRUE;
+}
+
+static void
+line_processor_segment_end(void* context, long pos, bool_t error)
+{
+	line_processor_state_t* state = context;
+
+	state->block_state->member_start = TRUE;
 }
 
 static void
@@ -771,6 +2254,8 @@ line_processor_process(void* context, u_char* pos, size_t size)
 	u_char* line_buffer;
 	size_t line_size;
 
+	state->block_state->stats.inflated += size;
+
 	for (end = pos + size; pos < end; pos = cur_end)
 	{
 		// find a newline
@@ -784,6 +2269,7 @@ line_processor_process(void* context, u_char* pos, size_t size)
 			if (newline != NULL)
 			{
 				state->line_start = TRUE;
+				state->block_state->stop_at_block_start = state->range_end;
 			}
 			continue;
 		}
@@ -800,7 +2286,7 @@ line_processor_process(void* context, u_char* pos, size_t size)
 
 		if (newline == NULL)
 		{
-			if (state->line_buffer_size < sizeof(state->line_buffer))
+			if (state->line_buffer_size > 0 && state->line_buffer_size < sizeof(state->line_buffer))
 			{
 				// wait for more data
 				break;
@@ -822,8 +2308,15 @@ line_processor_process(void* context, u_char* pos, size_t size)
 			line_size = cur_end - pos;
 		}
 
+		state->block_state->stats.lines++;
 		block_processor_line_start(state->block_state, line_buffer, line_size);
 
+		if (state->block_state->done)
+		{
+			compressed_file_stop(state->file);
+			return;
+		}
+
 		// pass all data up to cur_end to the block processor
 		if (state->line_buffer_size > 0)
 		{
@@ -832,6 +2325,11 @@ line_processor_process(void* context, u_char* pos, size_t size)
 		block_processor_append_data(state->block_state, pos, cur_end - pos);
 
 		state->line_buffer_size = 0;
+
+		if (newline != NULL)
+		{
+			state->block_state->stop_at_block_start = state->range_end;
+		}
 	}
 
 	// flush the block processor (should not keep any pointers after this function returns)
@@ -839,9 +2337,44 @@ line_processor_process(void* context, u_char* pos, size_t size)
 }
 
 /// main
+static void
+file_stats_add(file_stats_t* dest, file_stats_t* src)
+{
+	// Note: the ranges of a split file are processed by different threads
+	__sync_fetch_and_add(&dest->inflated, src->inflated);
+	__sync_fetch_and_add(&dest->lines, src->lines);
+	__sync_fetch_and_add(&dest->blocks, src->blocks);
+	__sync_fetch_and_add(&dest->output_blocks, src->output_blocks);
+}
+
+static void
+print_stats(char** files, long file_count)
+{
+	file_stats_t* cur;
+	long i;
+
+	fflush(stdout);
+
+	fprintf(stderr, "files:\n");
+	for (i = 0; i < file_count; i++)
+	{
+		cur = &file_stats[i];
+		fprintf(stderr, "  %s: inflated=%" PRIu64 " lines=%" PRIu64 " blocks=%" PRIu64 " output_blocks=%" PRIu64 "\n",
+			files[i], cur->inflated, cur->lines, cur->blocks, cur->output_blocks);
+	}
+
+	capture_conditions_print_stats(stderr);
+
+	if (filter != NULL)
+	{
+		filter_stats_print(filter, stderr);
+	}
+}
+
 static int
-process_file(curl_ext_conf_t* conf, const char* file_name, int file_name_prefix)
+process_file(curl_ext_conf_t* conf, work_item_t* item, int file_name_prefix, output_buffer_t* output, block_buffer_t* block_buffer, group_map_t* groups)
 {
+	const char* file_name = item->file_name;
 	compressed_file_observer_t observer;
 	compressed_file_state_t compressed_file_state;
 	block_processor_state_t block_state;
@@ -854,11 +2387,37 @@ process_file(curl_ext_conf_t* conf, const char* file_name, int file_name_prefix)
 	// open the file
 	memset(&observer, 0, sizeof(observer));
 	observer.process_chunk = &line_processor_process;
+	observer.range_end = &line_processor_range_end;
+	if (sorted_mode)
+	{
+		observer.segment_end = &line_processor_segment_end;
+	}
 
 	file_pos = compressed_file_init(&compressed_file_state, conf, file_name, &observer, &line_state);
 	if (file_pos < 0)
 	{
-		return 1;
+		return 1;
+	}
+
+	if (prefetch_buffers > 0)
+	{
+		compressed_file_set_pipeline(&compressed_file_state, prefetch_buffers);
+	}
+
+	if (connections > 1)
+	{
+		compressed_file_set_connections(&compressed_file_state, connections);
+	}
+
+	if (item->split != NULL)
+	{
+		file_pos = compressed_file_set_soft_range(&compressed_file_state, item->start, item->end);
+		if (file_pos < 0 ||
+			!split_file_output_start(item->split, item->range_index))
+		{
+			compressed_file_free(&compressed_file_state);
+			return 1;
+		}
 	}
 
 	// initialize the prefix buffer
@@ -878,6 +2437,7 @@ process_file(curl_ext_conf_t* conf, const char* file_name, int file_name_prefix)
 		if (prefix_data == NULL)
 		{
 			error(0, "malloc failed");
+			compressed_file_free(&compressed_file_state);
 			return 1;
 		}
 
@@ -891,12 +2451,27 @@ process_file(curl_ext_conf_t* conf, const char* file_name, int file_name_prefix)
 	}
 
 	// initialize the state machines
-	block_processor_init(&block_state, prefix_data, prefix_len, block_delimiter, block_delimiter_len);
-
-	line_processor_init(&line_state, &block_state, file_pos == 0);
+	block_processor_init(
+		&block_state,
+		prefix_data,
+		prefix_len,
+		block_delimiter,
+		block_delimiter_len,
+		item->split != NULL ? &item->split->ranges[item->range_index] : NULL,
+		output,
+		block_buffer,
+		groups);
+
+	line_processor_init(&line_state, &block_state, &compressed_file_state, file_pos == 0);
 
 	compressed_file_process(&compressed_file_state);
 
+	block_processor_write_buffer(&block_state);
+
+	if (file_stats != NULL)
+	{
+		file_stats_add(&file_stats[item->file_index], &block_state.stats);
+	}
 
 	// clean up
 	free(prefix_data);
@@ -908,22 +2483,326 @@ static void*
 process_thread(void* data)
 {
 	thread_ctx_t* ctx = data;
+	work_item_t* item;
 	uintptr_t rc;
 	long i;
 
 	rc = EXIT_SUCCESS;
 
-	for (i = ctx->start; i < ctx->max; i += ctx->increment)
+	// Note: the items are sorted largest first, idle threads take the next item from the shared queue
+	for (;;)
 	{
-		if (process_file(ctx->conf, ctx->files[i], ctx->file_name_prefix) != 0)
+		i = ngx_atomic_fetch_add(&ctx->queue->next, 1);
+		if (i >= ctx->queue->count)
+		{
+			break;
+		}
+
+		item = &ctx->queue->items[i];
+
+		if (process_file(ctx->conf, item, ctx->file_name_prefix, &ctx->output, &ctx->block_buffer,
+			count_mode ? &ctx->groups : NULL) != 0)
 		{
 			rc = EXIT_ERROR;
 		}
+
+		if (item->split != NULL)
+		{
+			split_file_output_end(item->split, item->range_index);
+		}
 	}
 
+	free(ctx->output.data);
+	block_buffer_free(&ctx->block_buffer);
+	pcre_ext_thread_cleanup();
+	filter_thread_cleanup();
+
 	return (void*)rc;
 }
 
+/// work items
+static void
+free_work_items(work_item_t* items, long item_count)
+{
+	long i;
+
+	for (i = 0; i < item_count; i++)
+	{
+		if (items[i].split != NULL && items[i].range_index == 0)
+		{
+			free(items[i].split->ranges);
+			free(items[i].split);
+		}
+	}
+
+	free(items);
+}
+
+static bool_t
+is_file_range(const char* file_name, long* size)
+{
+	const char* colon_pos;
+	long start;
+	long end;
+
+	colon_pos = strrchr(file_name, ':');
+	if (colon_pos == NULL || colon_pos[1] == '/')
+	{
+		return FALSE;
+	}
+
+	if (sscanf(colon_pos + 1, "%ld-%ld", &start, &end) == 2)
+	{
+		*size = end - start;
+	}
+	else
+	{
+		*size = -1;
+	}
+
+	return TRUE;
+}
+
+static void*
+size_probe_thread(void* data)
+{
+	size_probe_t* probe = data;
+	long i;
+
+	for (;;)
+	{
+		i = ngx_atomic_fetch_add(&probe->next, 1);
+		if (i >= probe->count)
+		{
+			break;
+		}
+
+		if (!is_file_range(probe->files[i], &probe->sizes[i]))
+		{
+			probe->sizes[i] = compressed_file_get_size(probe->conf, probe->files[i]);
+		}
+	}
+
+	return NULL;
+}
+
+static bool_t
+get_file_sizes(curl_ext_conf_t* conf, char** files, long file_count, long max_threads, long* sizes)
+{
+	size_probe_t probe;
+	pthread_t* threads;
+	long thread_count;
+	long i;
+	int rc;
+
+	// Note: remote sizes require a request per file, the requests are performed in parallel
+	probe.conf = conf;
+	probe.files = files;
+	probe.sizes = sizes;
+	probe.count = file_count;
+	probe.next = 0;
+
+	thread_count = min(file_count, max_threads);
+
+	threads = malloc(sizeof(threads[0]) * thread_count);
+	if (threads == NULL)
+	{
+		error(0, "malloc failed");
+		return FALSE;
+	}
+
+	for (i = 0; i < thread_count; i++)
+	{
+		rc = pthread_create(&threads[i], NULL, size_probe_thread, &probe);
+		if (rc != 0)
+		{
+			error(rc, "pthread_create failed");
+			break;
+		}
+	}
+
+	thread_count = i;
+	for (i = 0; i < thread_count; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+
+	free(threads);
+
+	return rc == 0;
+}
+
+static bool_t
+split_file(work_item_t* cur_item, long size, long range_count)
+{
+	split_file_t* split;
+	long i;
+
+	split = malloc(sizeof(*split));
+	if (split == NULL)
+	{
+		error(0, "malloc failed");
+		return FALSE;
+	}
+
+	split->ranges = calloc(range_count, sizeof(split->ranges[0]));
+	if (split->ranges == NULL)
+	{
+		error(0, "calloc failed");
+		free(split);
+		return FALSE;
+	}
+
+	split->count = range_count;
+	split->next = 0;
+	split->ranges[0].fp = stdout;
+
+	// Note: the ranges are soft, a gzip member belongs to the range in which it starts
+	for (i = 0; i < range_count; i++, cur_item++)
+	{
+		cur_item->split = split;
+		cur_item->range_index = i;
+		cur_item->start = size * i / range_count;
+		cur_item->end = i + 1 < range_count ? size * (i + 1) / range_count : 0;
+	}
+
+	return TRUE;
+}
+
+static int
+compare_work_items(const void* p1, const void* p2)
+{
+	const work_item_t* item1 = p1;
+	const work_item_t* item2 = p2;
+
+	// unknown sizes first, since they can't be ranked, then largest first
+	if (item1->file_size != item2->file_size)
+	{
+		if (item1->file_size < 0 || item2->file_size < 0)
+		{
+			return item1->file_size < 0 ? -1 : 1;
+		}
+
+		return item1->file_size > item2->file_size ? -1 : 1;
+	}
+
+	// keep the ranges of a file in order, for minimizing the buffered output
+	// Note: sorting by the file size (not by the range size) keeps the ranges of a file together
+	if (item1->file_index != item2->file_index)
+	{
+		return item1->file_index < item2->file_index ? -1 : 1;
+	}
+
+	return item1->range_index < item2->range_index ? -1 : (item1->range_index > item2->range_index);
+}
+
+static work_item_t*
+create_work_items(curl_ext_conf_t* conf, char** files, long file_count, long max_threads, long* item_count)
+{
+	work_item_t* items = NULL;
+	work_item_t* cur_item;
+	long* range_counts;
+	long* sizes;
+	long range_size;
+	long total_size;
+	long file_size;
+	long count;
+	long i;
+
+	sizes = malloc(sizeof(sizes[0]) * file_count * 2);
+	if (sizes == NULL)
+	{
+		error(0, "malloc failed");
+		return NULL;
+	}
+
+	range_counts = sizes + file_count;
+
+	// get the file sizes, not needed with a single thread
+	for (i = 0; i < file_count; i++)
+	{
+		sizes[i] = -1;
+	}
+
+	if (max_threads > 1 &&
+		!get_file_sizes(conf, files, file_count, max_threads, sizes))
+	{
+		goto done;
+	}
+
+	// split large files, so that no file takes more than its share of the threads
+	total_size = 0;
+	for (i = 0; i < file_count; i++)
+	{
+		if (sizes[i] > 0)
+		{
+			total_size += sizes[i];
+		}
+	}
+
+	range_size = max(total_size / max_threads, SPLIT_MIN_RANGE_SIZE);
+
+	count = 0;
+	for (i = 0; i < file_count; i++)
+	{
+		range_counts[i] = 1;
+		if (sizes[i] > 0 && !is_file_range(files[i], &file_size))
+		{
+			range_counts[i] = max(min(sizes[i] / range_size, max_threads), 1);
+		}
+
+		count += range_counts[i];
+	}
+
+	items = malloc(sizeof(items[0]) * count);
+	if (items == NULL)
+	{
+		error(0, "malloc failed");
+		goto done;
+	}
+
+	cur_item = items;
+	for (i = 0; i < file_count; i++)
+	{
+		cur_item->file_name = files[i];
+		cur_item->file_index = i;
+		cur_item->file_size = sizes[i];
+		cur_item->split = NULL;
+		cur_item->range_index = 0;
+		cur_item->start = 0;
+		cur_item->end = 0;
+
+		if (range_counts[i] <= 1)
+		{
+			cur_item++;
+			continue;
+		}
+
+		for (count = 1; count < range_counts[i]; count++)
+		{
+			cur_item[count] = cur_item[0];
+		}
+
+		if (!split_file(cur_item, sizes[i], range_counts[i]))
+		{
+			free_work_items(items, cur_item - items);
+			items = NULL;
+			goto done;
+		}
+
+		cur_item += range_counts[i];
+	}
+
+	*item_count = cur_item - items;
+
+	qsort(items, *item_count, sizeof(items[0]), compare_work_items);
+
+done:
+
+	free(sizes);
+	return items;
+}
+
 static void
 usage(int status)
 {
@@ -942,7 +2821,9 @@ A block is a set of lines, the first of which matches a provided regular\n\
 expression.\n\
 \n\
 Each FILE may contain a range specification of the format FILE:START-END,\n\
-where START and END are byte offsets within the file.\n");
+where START and END are byte offsets within the file.\n\
+The files are processed largest first, and large files are split to ranges\n\
+that are processed in parallel, the output of each file remains ordered.\n");
 
 		printf ("\
 Example: %s -p '(\\d{2}:\\d{2}:\\d{2})' -c '$1>=12:34:56' input.log.gz\n\
@@ -951,6 +2832,34 @@ Example: %s -p '(\\d{2}:\\d{2}:\\d{2})' -c '$1>=12:34:56' input.log.gz\n\
 		printf ("\
 \n\
       --help                display this help text and exit\n\
+      --stats               print statistics to stderr on exit - per file\n\
+                            inflated bytes, lines, blocks and output blocks,\n\
+                            and per capture condition / filter evaluations,\n\
+                            matches and cpu cycles\n\
+      --sorted[=COUNT]      the values of $1 are sorted within each file, stop\n\
+                            processing a file (or a range) when the first block\n\
+                            of a gzip member is above an upper bound condition\n\
+                            on $1 (=, <, <=), or when COUNT consecutive blocks\n\
+                            are above it\n\
+      --count               print the number of matching blocks instead of\n\
+                            the blocks\n\
+      --group-by            count the matching blocks per value of a capture\n\
+                            expression, e.g. '$2' or '$1-$2'. the groups are\n\
+                            printed largest first, a tab separated count and\n\
+                            value per line\n\
+      --min-max             print the min / max value of a capture expression\n\
+                            per group (e.g. the time range), compared as\n\
+                            strings, implies --count\n\
+      --max-block-size      the max size in bytes of a block that is filtered\n\
+                            as a whole, larger blocks are filtered in chunks.\n\
+                            the default is 16MB\n\
+      --prefetch[=COUNT]    read the input of each file in a separate thread,\n\
+                            up to COUNT 1MB buffers (16 by default) ahead of\n\
+                            the processing. useful for remote files, when the\n\
+                            filters are cpu intensive\n\
+      --connections         the number of concurrent range requests used to\n\
+                            fetch each remote file (or range), in 8MB parts.\n\
+                            the default is 1\n\
   -H, --with-filename       print the file name for each match\n\
   -h, --no-filename         suppress the file name prefix on output\n\
   -p, --pattern             a regular expression that identifies block start.\n\
@@ -997,6 +2906,14 @@ following types are supported:\n\
     dotall      optional boolean, see PCRE_DOTALL\n\
     ungreedy    optional boolean, see PCRE_UNGREEDY\n\
 \n\
+- field       JSON field comparison (e.g. JSON log lines), the object starts\n\
+              at the first { of the block, has the following properties -\n\
+    path        string, the key path of the field, e.g. a.b\n\
+    op          optional string, one of =, !=, <, <=, >, >=, exists,\n\
+                default =\n\
+    value       string / number / bool / null, the reference value,\n\
+                values of a different type are not equal to it\n\
+\n\
 - not         logical NOT operator, has the following properties -\n\
     filter      a filter object\n\
 \n\
@@ -1016,6 +2933,8 @@ main(int argc, char **argv)
 	curl_ext_conf_t* conf;
 	thread_ctx_t* threads;
 	thread_ctx_t* cur_thread;
+	work_item_t* items;
+	work_queue_t queue;
 	const char *conf_file = NULL;
 	const char *errstr;
 	CURLcode res;
@@ -1024,9 +2943,13 @@ main(int argc, char **argv)
 	char* end;
 	char error_str[128];
 	long thread_count;
+	long item_count;
 	long max_threads;
+	long block_size;
 	long i;
 	int prefix_mode = PM_UNDEFINED;
+	int capture_count;
+	int capture_index;
 	int erroff;
 	int opt;
 	int rc;
@@ -1104,6 +3027,71 @@ main(int argc, char **argv)
 			conf_file = optarg;
 			break;
 
+		case GROUP_BY_OPTION:
+		case MIN_MAX_OPTION:
+			if (opt == GROUP_BY_OPTION)
+			{
+				group_by = parse_capture_expression(optarg, strlen(optarg), &capture_index);
+			}
+			else
+			{
+				min_max = parse_capture_expression(optarg, strlen(optarg), &capture_index);
+			}
+
+			if ((opt == GROUP_BY_OPTION ? group_by : min_max) == NULL)
+			{
+				return EXIT_ERROR;
+			}
+
+			group_max_capture_index = max(group_max_capture_index, capture_index);
+			count_mode = 1;
+			break;
+
+		case MAX_BLOCK_SIZE_OPTION:
+			block_size = strtol(optarg, &end, 10);
+			if (*end != '\0' || block_size < BLOCK_BUFFER_INITIAL_SIZE)
+			{
+				error(0, "invalid max block size %s, the min is %d", optarg, BLOCK_BUFFER_INITIAL_SIZE);
+				return EXIT_ERROR;
+			}
+			max_block_size = block_size;
+			break;
+
+		case PREFETCH_OPTION:
+			prefetch_buffers = PREFETCH_DEFAULT_BUFFERS;
+			if (optarg != NULL)
+			{
+				prefetch_buffers = strtol(optarg, &end, 10);
+				if (*end != '\0' || prefetch_buffers <= 0)
+				{
+					error(0, "invalid prefetch buffer count %s", optarg);
+					return EXIT_ERROR;
+				}
+			}
+			break;
+
+		case CONNECTIONS_OPTION:
+			connections = strtol(optarg, &end, 10);
+			if (*end != '\0' || connections <= 0 || connections > MAX_CONNECTIONS)
+			{
+				error(0, "invalid connection count %s, the max is %d", optarg, MAX_CONNECTIONS);
+				return EXIT_ERROR;
+			}
+			break;
+
+		case SORTED_OPTION:
+			sorted_mode = 1;
+			if (optarg != NULL)
+			{
+				sorted_max_failures = strtol(optarg, &end, 10);
+				if (*end != '\0' || sorted_max_failures <= 0)
+				{
+					error(0, "invalid sorted failure count %s", optarg);
+					return EXIT_ERROR;
+				}
+			}
+			break;
+
 		case 0:
 			// long options
 			break;
@@ -1124,6 +3112,26 @@ main(int argc, char **argv)
 		usage(EXIT_SUCCESS);
 	}
 
+	if (show_stats)
+	{
+		file_stats = calloc(argc - optind, sizeof(file_stats[0]));
+		if (file_stats == NULL)
+		{
+			error(0, "calloc failed");
+			return EXIT_ERROR;
+		}
+
+		if (filter != NULL)
+		{
+			filter_stats_enable(filter);
+		}
+	}
+
+	if (sorted_mode && capture_conditions != NULL)
+	{
+		capture_conditions_sorted_bounds_first();
+	}
+
 	if (prefix_mode == PM_UNDEFINED)
 	{
 		if (argc - optind > 1)
@@ -1152,12 +3160,24 @@ main(int argc, char **argv)
 		return EXIT_ERROR;
 	}
 
-	regex.extra = pcre_study(regex.code, 0, &errstr);
+	regex.extra = pcre_ext_study(regex.code, &errstr);
 	if (errstr != NULL)
 	{
 		error(0, "pcre_study() failed: %s", errstr);
 	}
 
+	prefilter_init(&prefilter, pattern);
+
+	if (group_max_capture_index >= 0)
+	{
+		if (pcre_fullinfo(regex.code, regex.extra, PCRE_INFO_CAPTURECOUNT, &capture_count) != 0 ||
+			group_max_capture_index >= capture_count)
+		{
+			error(0, "the group by / min-max expression refers to a capture that is not in the pattern");
+			return EXIT_ERROR;
+		}
+	}
+
 	// init curl
 	res = curl_global_init(CURL_GLOBAL_DEFAULT);
 	if (res != CURLE_OK)
@@ -1172,7 +3192,13 @@ main(int argc, char **argv)
 		return EXIT_ERROR;
 	}
 
-	thread_count = argc - optind;
+	items = create_work_items(conf, argv + optind, argc - optind, max_threads, &item_count);
+	if (items == NULL)
+	{
+		return EXIT_ERROR;
+	}
+
+	thread_count = item_count;
 	if (thread_count > max_threads)
 	{
 		thread_count = max_threads;
@@ -1185,14 +3211,22 @@ main(int argc, char **argv)
 		return EXIT_ERROR;
 	}
 
+	queue.items = items;
+	queue.count = item_count;
+	queue.next = 0;
+
 	cur_thread = threads;
 
 	for (i = 0; i < thread_count; i++)
 	{
-		cur_thread->files = argv;
-		cur_thread->start = optind + i;
-		cur_thread->max = argc;
-		cur_thread->increment = thread_count;
+		cur_thread->queue = &queue;
+		memset(&cur_thread->output, 0, sizeof(cur_thread->output));
+		memset(&cur_thread->block_buffer, 0, sizeof(cur_thread->block_buffer));
+
+		if (count_mode && !group_map_init(&cur_thread->groups))
+		{
+			return EXIT_ERROR;
+		}
 
 		cur_thread->conf = conf;
 		cur_thread->file_name_prefix = prefix_mode == PM_WITH_FILENAME;
@@ -1217,8 +3251,35 @@ main(int argc, char **argv)
 		}
 	}
 
+	if (count_mode)
+	{
+		for (i = 1; i < thread_count; i++)
+		{
+			if (!group_map_merge(&threads[0].groups, &threads[i].groups))
+			{
+				error(0, "group_map_merge failed");
+				return EXIT_ERROR;
+			}
+			group_map_free(&threads[i].groups);
+		}
+
+		if (!group_map_print(&threads[0].groups))
+		{
+			rc = EXIT_ERROR;
+		}
+		group_map_free(&threads[0].groups);
+	}
+
 	free(threads);
 
+	free_work_items(items, item_count);
+
+	if (show_stats)
+	{
+		print_stats(argv + optind, argc - optind);
+		free(file_stats);
+	}
+
 	curl_ext_conf_free(conf);
 
 	curl_global_cleanup();
@@ -1 +1 @@
-gcc -g -O2 -Wall -DINI_MAX_LINE=4096 -o zgrepindex zgrepindex.c ../compressed_file.c ../curl_ext.c ../curl_ext_s3.c ../capture_expression.c ../common.c ../inih/ini.c -I../inih/ -lz -lpcre -lcurl -lcrypto
\ No newline at end of file
+gcc -g -O2 -Wall -DINI_MAX_LINE=4096 -o zgrepindex zgrepindex.c ../segment_index.c ../compressed_file.c ../compressed_file_local.c ../compressed_file_curl.c ../itp.c ../buffer_pool.c ../curl_ext.c ../curl_ext_s3.c ../capture_expression.c ../pcre_ext.c ../common.c ../inih/ini.c -I../inih/ -lz -lpcre -lcurl -lcrypto -pthread
\ No newline at end of file
@@ -2,17 +2,22 @@
 typedef unsigned char u_char;
 
 #include <getopt.h>
+#include <errno.h>
 #include <string.h>
 #include <time.h>
-#include <pcre.h>
+#include <zlib.h>
 #include "../capture_expression.h"
+#include "../pcre_ext.h"
 #include "../compressed_file.h"
+#include "../segment_index.h"
 #include "../common.h"
 
 // constants
 #define MAX_LINE_SIZE (1024)
 #define MAX_CAPTURE_SIZE (1024)
 #define MIN_SEGMENT_SIZE (524288)		// TODO: add cmdline switch
+#define BINARY_INDEX_INITIAL_SEGMENTS (1024)
+#define BINARY_INDEX_INITIAL_VALUES (65536)
 
 // enum
 enum {
@@ -33,21 +38,48 @@ typedef struct {
 	size_t min_value_size;
 	u_char max_value[MAX_CAPTURE_SIZE];
 	size_t max_value_size;
+
+	// segment stats
+	uint64_t uncomp_size;
+	uint64_t line_count;
+	uLong member_crc;				// crc32 of the current gzip member, binary index only
+	uLong last_member_crc;
 } line_processor_state_t;
 
+typedef struct {
+	uint64_t offset;
+	uint64_t size;
+	uint64_t uncomp_size;
+	uint64_t line_count;
+	size_t min_value;				// offsets in binary_index_t.values
+	size_t max_value;
+} binary_index_segment_t;
+
+typedef struct {
+	binary_index_segment_t* segments;
+	size_t count;
+	size_t alloc_count;
+	char* values;
+	size_t values_size;
+	size_t values_alloc;
+	size_t value_size;				// max value length including the null
+	bool_t failed;
+} binary_index_t;
+
 typedef struct {
 	pcre *code;
 	pcre_extra *extra;
 } regex_t;
 
 // constants
-static char const short_options[] = "p:t:c:i:";
+static char const short_options[] = "p:t:c:i:b";
 static struct option const long_options[] =
 {
 	{"pattern", required_argument, NULL, 'p'},
 	{"time-format", required_argument, NULL, 't'},
 	{"capture-expression", required_argument, NULL, 'c'},
 	{"ini", required_argument, NULL, 'i'},
+	{"binary", no_argument, NULL, 'b'},
 	{0, 0, 0, 0}
 };
 
@@ -56,6 +88,8 @@ static int show_help = 0;
 static const char* file_name;
 static const char* time_format = NULL;
 static regex_t regex;
+static bool_t binary_output = FALSE;
+static binary_index_t binary_index;
 
 static capture_expression_t* capture_expression = NULL;
 static capture_expression_t default_capture_expression[2];
@@ -90,6 +124,12 @@ Example: %s -p '(\\d{2}:\\d{2}:\\d{2})' input.log.gz\n\
                             strptime format. when not provided, string\n\
                             comparison is used to compare timestamps\n\
   -i, --ini                 sets an ini file containing request params.\n\
+  -b, --binary              write a binary segment index to stdout, instead\n\
+                            of text. the binary index can be mmapped and\n\
+                            bisected in place (see segment_index.h), and\n\
+                            records the size and checksum of the gzip file,\n\
+                            for detecting a stale index. can be used with a\n\
+                            single FILE only.\n\
 ");
 	}
 	exit(status);
@@ -149,6 +189,11 @@ line_processor_reset(line_processor_state_t* state, bool_t line_start)
 	state->last_value_size = 0;
 	state->min_value_size = 0;
 	state->max_value_size = 0;
+
+	state->uncomp_size = 0;
+	state->line_count = 0;
+	state->member_crc = crc32(0L, Z_NULL, 0);
+	state->last_member_crc = state->member_crc;
 }
 
 static void
@@ -158,6 +203,159 @@ line_processor_next_segment(line_processor_state_t* state)
 	state->min_value_size = state->last_value_size;
 	memcpy(state->max_value, state->last_value, state->last_value_size + 1);	// copy the null
 	state->max_value_size = state->last_value_size;
+
+	state->uncomp_size = 0;
+	state->line_count = 0;
+}
+
+static void
+line_processor_member_end(line_processor_state_t* state)
+{
+	state->last_member_crc = state->member_crc;
+	state->member_crc = crc32(0L, Z_NULL, 0);
+}
+
+/// binary index
+static size_t
+binary_index_add_value(u_char* value, size_t size)
+{
+	size_t new_alloc;
+	char* new_values;
+	size_t result;
+
+	if (binary_index.values_size + size + 1 > binary_index.values_alloc)
+	{
+		new_alloc = max(binary_index.values_alloc * 2, BINARY_INDEX_INITIAL_VALUES);
+		new_alloc = max(new_alloc, binary_index.values_size + size + 1);
+		new_values = realloc(binary_index.values, new_alloc);
+		if (new_values == NULL)
+		{
+			return (size_t)-1;
+		}
+		binary_index.values = new_values;
+		binary_index.values_alloc = new_alloc;
+	}
+
+	result = binary_index.values_size;
+	memcpy(binary_index.values + result, value, size + 1);		// copy the null
+	binary_index.values_size += size + 1;
+
+	binary_index.value_size = max(binary_index.value_size, size + 1);
+	return result;
+}
+
+static void
+binary_index_add(line_processor_state_t* state, long start_offset, long end_offset)
+{
+	binary_index_segment_t* new_segments;
+	binary_index_segment_t* cur;
+	size_t new_alloc;
+
+	if (binary_index.failed)
+	{
+		return;
+	}
+
+	if (binary_index.count >= binary_index.alloc_count)
+	{
+		new_alloc = binary_index.alloc_count != 0 ? binary_index.alloc_count * 2 : BINARY_INDEX_INITIAL_SEGMENTS;
+		new_segments = realloc(binary_index.segments, sizeof(binary_index.segments[0]) * new_alloc);
+		if (new_segments == NULL)
+		{
+			goto failed;
+		}
+		binary_index.segments = new_segments;
+		binary_index.alloc_count = new_alloc;
+	}
+
+	cur = &binary_index.segments[binary_index.count];
+	cur->offset = start_offset;
+	cur->size = end_offset - start_offset;
+	cur->uncomp_size = state->uncomp_size;
+	cur->line_count = state->line_count;
+
+	cur->min_value = binary_index_add_value(state->min_value, state->min_value_size);
+	cur->max_value = binary_index_add_value(state->max_value, state->max_value_size);
+	if (cur->min_value == (size_t)-1 || cur->max_value == (size_t)-1)
+	{
+		goto failed;
+	}
+
+	binary_index.count++;
+	return;
+
+failed:
+
+	error(0, "realloc failed");
+	binary_index.failed = TRUE;
+}
+
+static bool_t
+binary_index_write(FILE* fp, uint64_t source_size, uint32_t checksum)
+{
+	segment_index_header_t header;
+	segment_index_record_t* record;
+	binary_index_segment_t* cur;
+	binary_index_segment_t* end;
+	size_t value_size;
+	bool_t result = FALSE;
+
+	value_size = (max(binary_index.value_size, 1) + 7) & ~7;		// keep the records aligned
+
+	memset(&header, 0, sizeof(header));
+	header.magic = SEGMENT_INDEX_MAGIC;
+	header.version = SEGMENT_INDEX_VERSION;
+	header.header_size = sizeof(header);
+	header.record_size = SEGMENT_INDEX_RECORD_SIZE(value_size);
+	header.value_size = value_size;
+	header.checksum = checksum;
+	header.source_size = source_size;
+
+	record = malloc(header.record_size);
+	if (record == NULL)
+	{
+		error(0, "malloc failed");
+		return FALSE;
+	}
+
+	if (fwrite(&header, sizeof(header), 1, fp) != 1)
+	{
+		goto failed;
+	}
+
+	end = binary_index.segments + binary_index.count;
+	for (cur = binary_index.segments; cur < end; cur++)
+	{
+		memset(record, 0, header.record_size);
+		record->offset = cur->offset;
+		record->size = cur->size;
+		record->uncomp_size = cur->uncomp_size;
+		record->line_count = cur->line_count;
+		strcpy(segment_index_min_value(record), binary_index.values + cur->min_value);
+		strcpy(segment_index_max_value(record, value_size), binary_index.values + cur->max_value);
+
+		if (fwrite(record, header.record_size, 1, fp) != 1)
+		{
+			goto failed;
+		}
+	}
+
+	if (fflush(fp) != 0)
+	{
+		goto failed;
+	}
+
+	result = TRUE;
+
+failed:
+
+	if (!result)
+	{
+		error(errno, "failed to write the index");
+	}
+
+	free(record);
+	return result;
 }
 
 static void
@@ -168,6 +366,12 @@ line_processor_print(line_processor_state_t* state, long start_offset, long end_
 		return;
 	}
 
+	if (binary_output)
+	{
+		binary_index_add(state, start_offset, end_offset);
+		return;
+	}
+
 	printf("%ld\t%ld\t%s\t%s\n", start_offset, end_offset, state->min_value, state->max_value);
 }
 
@@ -184,12 +388,23 @@ line_processor_process(void* context, u_char* pos, size_t size)
 	int captures[(1 + MAX_CAPTURES) * 3];
 	int exec_result;
 
+	state->uncomp_size += size;
+	if (binary_output)
+	{
+		state->member_crc = crc32(state->member_crc, pos, size);
+	}
+
 	for (end = pos + size; pos < end; pos = cur_end)
 	{
 		// find a newline
 		newline = memchr(pos, '\n', end - pos);
 		cur_end = newline != NULL ? newline + 1 : end;
 
+		if (newline != NULL)
+		{
+			state->line_count++;
+		}
+
 		if (!state->line_start)
 		{
 			// ignore all data until a newline is found
@@ -235,7 +450,7 @@ line_processor_process(void* context, u_char* pos, size_t size)
 			line_size = cur_end - pos;
 		}
 
-		exec_result = pcre_exec(
+		exec_result = pcre_ext_exec(
 			regex.code,
 			regex.extra,
 			(const char *)line_buffer,
@@ -300,6 +515,8 @@ index_segment_end(void* context, long pos, bool_t error)
 
 	state->segment_end = pos;
 
+	line_processor_member_end(&state->lines);
+
 	if (pos - state->segment_start < MIN_SEGMENT_SIZE && !error)
 	{
 		return;
@@ -327,6 +544,7 @@ process_file(curl_ext_conf_t* conf)
 	int result = 1;
 
 	// initialize
+	memset(&observer, 0, sizeof(observer));
 	observer.process_chunk = line_processor_process;
 	observer.resync = index_resync;
 	observer.segment_end = index_segment_end;
@@ -351,6 +569,12 @@ process_file(curl_ext_conf_t* conf)
 		line_processor_print(&state.lines, state.segment_start, state.segment_end);
 	}
 
+	if (binary_output &&
+		(binary_index.failed || !binary_index_write(stdout, state.segment_end, state.lines.last_member_crc)))
+	{
+		result = 1;
+	}
+
 	compressed_file_free(&state.file);
 	return result;
 }
@@ -403,6 +627,10 @@ main(int argc, char **argv)
 				conf_file = optarg;
 				break;
 
+			case 'b':
+				binary_output = TRUE;
+				break;
+
 			case 0:
 				// long options
 				break;
@@ -423,6 +651,12 @@ main(int argc, char **argv)
 		usage(EXIT_SUCCESS);
 	}
 
+	if (binary_output && argc - optind > 1)
+	{
+		error(0, "a binary index can be created for a single file only");
+		return EXIT_ERROR;
+	}
+
 	if (capture_expression == NULL)
 	{
 		capture_expression = default_capture_expression;
@@ -447,7 +681,7 @@ main(int argc, char **argv)
 		return EXIT_ERROR;
 	}
 
-	regex.extra = pcre_study(regex.code, 0, &errstr);
+	regex.extra = pcre_ext_study(regex.code, &errstr);
 	if (errstr != NULL)
 	{
 		error(0, "pcre_study() failed: %s", errstr);